@@ -47,7 +47,7 @@ public:
   void register_cb(enum nl_cb_type type, nl_recvmsg_msg_cb_t handler_cb,
                    void *arg) {
     enum nl_cb_kind kind = NL_CB_CUSTOM;
-    int ret = nl_cb_set(nlcbs.get(), NL_CB_SEQ_CHECK, kind, handler_cb, arg);
+    int ret = nl_cb_set(nlcbs.get(), type, kind, handler_cb, arg);
     if (ret != 0) {
       throw std::runtime_error("nl_cb_set failed with code " +
                                std::to_string(ret));
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <chrono>
+#include <libnl++/wlanapp_common.hpp>
+#include <optional>
+#include <string>
+
+namespace nl {
+
+enum class CaptureDirection : u8 { RX, TX };
+
+/*
+ * Append-only writer of pcap files with the LINKTYPE_NETLINK link type, i.e.
+ * the same format nlmon produces, so captures open in Wireshark/tcpdump as
+ * well as in CaptureReader. The file is memory mapped and grown in chunks, so
+ * recording a datagram is a memcpy without syscalls in the common case and
+ * everything recorded so far survives a crash of the process.
+ *
+ * Not thread-safe: share a writer only between sockets used by one thread.
+ */
+class CaptureWriter {
+  int fd = -1;
+  u8 *map = nullptr;
+  size_t mapped = 0;
+  size_t used = 0;
+
+  void _reserve(size_t bytes);
+
+public:
+  /*
+   * CaptureWriter ctor.
+   * @arg path - capture file to create, truncated if it exists
+   */
+  explicit CaptureWriter(const std::string &path);
+  ~CaptureWriter();
+
+  CaptureWriter(const CaptureWriter &other) = delete;
+  CaptureWriter &operator=(const CaptureWriter &other) = delete;
+
+  /*
+   * Record one datagram.
+   * @param dir - whether the datagram was received or sent
+   * @param nl_protocol - netlink protocol of the socket (NETLINK_USERSOCK...)
+   * @param data - datagram bytes, one or more netlink messages
+   * @param len - datagram length
+   */
+  void write(CaptureDirection dir, int nl_protocol, const void *data,
+             size_t len);
+
+  size_t size() const { return used; }
+};
+
+/*
+ * Sequential reader over a memory mapped capture written by CaptureWriter
+ * (or any native byte order pcap with LINKTYPE_NETLINK, e.g. from nlmon).
+ */
+class CaptureReader {
+  int fd = -1;
+  const u8 *map = nullptr;
+  size_t file_size = 0;
+  size_t pos = 0;
+  bool nsec_timestamps = true;
+
+public:
+  struct Record {
+    std::chrono::nanoseconds timestamp; // since the epoch
+    CaptureDirection dir;
+    int nl_protocol;
+    const u8 *data; // netlink messages, valid while the reader lives
+    size_t len;
+    size_t orig_len; // length on the wire, more than len if truncated
+  };
+
+  explicit CaptureReader(const std::string &path);
+  ~CaptureReader();
+
+  CaptureReader(const CaptureReader &other) = delete;
+  CaptureReader &operator=(const CaptureReader &other) = delete;
+
+  /*
+   * @return next record or nullopt at the end of the capture
+   */
+  std::optional<Record> next();
+
+  /*
+   * Start over from the first record.
+   */
+  void rewind();
+};
+
+} // namespace nl
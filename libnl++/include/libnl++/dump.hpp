@@ -0,0 +1,113 @@
+#pragma once
+
+#include <libnl++/message.hpp>
+#include <libnl++/socket.hpp>
+#include <libnl++/wlanapp_common.hpp>
+#include <stdexcept>
+
+namespace nl {
+
+/*
+ * Server side of an NLM_F_DUMP style exchange. Records are packed into a
+ * sequence of NLM_F_MULTI messages, each filled up to a target size, and the
+ * sequence is terminated with NLMSG_DONE. Only the message being filled is
+ * buffered, so memory use doesn't depend on the size of the dataset.
+ *
+ * Every message carries a resume cursor (the position right after its last
+ * record) in cursor_attr, so a client whose dump got interrupted can request
+ * a new one starting from the last cursor it has seen.
+ *
+ * On a blocking socket a slow reader throttles the dump. On a non-blocking
+ * socket a full client receive buffer holds the completed message back
+ * instead: end_record()/finish() return false and the caller parks the dump
+ * and retries with flush() later, so a client that stops reading never
+ * blocks the thread serving the others.
+ *
+ * The client side needs nothing special: Socket::recv_msg() invokes the
+ * valid callback for every message as it arrives and returns on NLMSG_DONE.
+ */
+class DumpWriter {
+  Socket &sock;
+  u8 nl_cmd;
+  int family_id;
+  u32 seq;
+  int cursor_attr;
+  size_t target_size;
+
+  Message msg;
+  size_t records_in_msg = 0;
+  u64 cursor = 0;
+  u64 total_records = 0;
+  u64 total_msgs = 0;
+  bool held = false;      // msg is complete and waits to be sent
+  bool finishing = false; // no more records, NLMSG_DONE follows
+  bool done_queued = false;
+  bool finished = false;
+
+  void _start_msg();
+  void _seal_msg();
+  void _queue_done();
+
+public:
+  static constexpr size_t DEFAULT_TARGET_SIZE = 8192;
+  static constexpr size_t DEFAULT_MAX_RECORD_SIZE = 4096;
+
+  /*
+   * DumpWriter ctor.
+   * @arg sock - socket to send the dump through, peer port must be set
+   * whenever the writer sends
+   * @arg nl_cmd - command put into every message header
+   * @arg family_id - family put into every message header
+   * @arg seq - sequence number of the dump request
+   * @arg cursor_attr - u64 attribute carrying the resume cursor
+   * @arg target_size - message size after which a message is sent
+   * @arg max_record_size - upper bound for a single record's attributes
+   */
+  DumpWriter(Socket &sock, u8 nl_cmd, int family_id, u32 seq, int cursor_attr,
+             size_t target_size = DEFAULT_TARGET_SIZE,
+             size_t max_record_size = DEFAULT_MAX_RECORD_SIZE);
+  ~DumpWriter();
+
+  DumpWriter(const DumpWriter &other) = delete;
+  DumpWriter &operator=(const DumpWriter &other) = delete;
+
+  /*
+   * Message the next record's attributes should be put into.
+   * @throw std::logic_error while a message is held back
+   */
+  Message &record() {
+    if (held || finishing) {
+      throw std::logic_error("dump can't take records now");
+    }
+    return msg;
+  }
+
+  /*
+   * Complete the record put into record().
+   * @param next_cursor - position to resume from after this record
+   * @return false if the message it completed is held back because the
+   * client can't take it yet; no records may be added until flush() returns
+   * true
+   */
+  bool end_record(u64 next_cursor);
+
+  /*
+   * Retry sending a held back message.
+   * @return true if nothing is held back anymore
+   */
+  bool flush();
+
+  /*
+   * Send the last partial message followed by NLMSG_DONE. May be called
+   * again to retry.
+   * @return false if held back, call flush() or finish() until it returns
+   * true
+   */
+  bool finish();
+
+  bool is_finished() const { return finished; }
+  u64 records() const { return total_records; }
+  u64 messages() const { return total_msgs; }
+};
+
+} // namespace nl
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <libnl++/transport.hpp>
+#include <memory>
+#include <mutex>
+#include <sys/socket.h>
+#include <unordered_map>
+
+namespace nl {
+
+class LoopbackQueue;
+
+/*
+ * Port namespace of loopback transports: sockets attached to the same hub
+ * reach each other by port like netlink sockets in the kernel do, sockets on
+ * different hubs are isolated. The lock is only taken to bind/unbind ports
+ * and when a sender switches to a new peer port.
+ */
+class LoopbackHub {
+  std::mutex mutex;
+  std::unordered_map<u32, std::shared_ptr<LoopbackQueue>> ports;
+
+public:
+  /*
+   * @throw std::runtime_error if the port is already bound
+   */
+  void bind(u32 port, std::shared_ptr<LoopbackQueue> queue);
+
+  void unbind(u32 port, const LoopbackQueue *queue);
+
+  /*
+   * @return receive queue of the port or nullptr if nothing is bound to it
+   */
+  std::shared_ptr<LoopbackQueue> lookup(u32 port);
+};
+
+/*
+ * In-process transport: datagrams are copied into a bounded lock-free queue
+ * of the destination port and handed to libnl as they are on the wire, so
+ * Message, callbacks, coalescing, dumps and the Reactor run unchanged while
+ * no syscall is made on the data path. fd() is an eventfd that is readable
+ * while datagrams are pending and is only written when the receiver ran dry.
+ *
+ * A full queue makes blocking senders spin until the receiver catches up and
+ * non-blocking ones fail with -NLE_AGAIN; sending to an unbound port fails
+ * with -NLE_OBJ_NOTFOUND. Multicast isn't supported. Credentials passed with
+ * datagrams are the ones of this process. Queues are bounded by datagram
+ * count rather than bytes, so buffer sizes are ignored.
+ */
+class LoopbackTransport : public Transport {
+  std::shared_ptr<LoopbackHub> hub;
+  std::shared_ptr<LoopbackQueue> rx_queue;
+  // last peer looked up, refreshed when the peer changes or goes away
+  u32 peer_port = 0;
+  std::shared_ptr<LoopbackQueue> peer_queue;
+  bool nonblocking = false;
+  bool passcred = false;
+  struct ucred own_creds; // attached to every datagram we send
+
+  LoopbackQueue *_peer_queue();
+
+public:
+  /*
+   * LoopbackTransport ctor.
+   * @arg hub - port namespace to join
+   * @arg queue_slots - max datagrams pending for this socket, rounded up to
+   * a power of two
+   */
+  explicit LoopbackTransport(std::shared_ptr<LoopbackHub> hub,
+                             size_t queue_slots = 1024);
+  ~LoopbackTransport() override;
+
+  void attach(struct nl_sock *sk, int nl_protocol, u32 port) override;
+  int fd() const override;
+  void set_nonblocking(bool nonblocking) override;
+  bool is_nonblocking() const override { return nonblocking; }
+  void set_local_port(u32 port) override;
+  int add_membership(int multicast_group_id) override;
+  int set_passcred(bool enable) override;
+  int set_buffer_size(int rxbuf, int txbuf) override { return 0; }
+  int send(const void *buf, size_t len) override;
+  int recv(struct sockaddr_nl *src, unsigned char **buf,
+           struct ucred **creds) override;
+};
+
+} // namespace nl
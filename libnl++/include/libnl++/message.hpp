@@ -38,6 +38,7 @@ class Message {
    */
   struct nlattr *nested_attr_start = nullptr;
   static nlmsg_unique_ptr create_nlmsg();
+  static nlmsg_unique_ptr create_nlmsg(size_t max_size);
   Message(const Message &other) = delete;
   Message &operator=(const Message &other) = delete;
 
@@ -47,9 +48,25 @@ public:
   Message &operator=(Message &&other) = default;
 
   Message() : nlmsg(create_nlmsg()) {}
+
+  /*
+   * Preallocate a message able to hold up to max_size bytes, so that it can be
+   * reused with reset() without touching the allocator.
+   */
+  explicit Message(size_t max_size) : nlmsg(create_nlmsg(max_size)) {}
   struct nl_msg *get() { return nlmsg.get(); }
 
-  Message &put_header(uint8_t nl_cmd, int family_id, u32 port);
+  /*
+   * Drop header and attributes, keeping the underlying buffer for reuse.
+   */
+  void reset();
+
+  Message &put_header(uint8_t nl_cmd, int family_id, u32 port, u32 seq = 0);
+
+  /*
+   * Set additional netlink header flags (NLM_F_MULTI, NLM_F_DUMP, ...).
+   */
+  Message &add_flags(int flags);
 
   /**
    * Add a unspecific attribute to netlink message.
@@ -80,6 +97,7 @@ public:
   Message &end_vendor_attr_block();
 
   Message &put_string(int attr, const std::string &data);
+  Message &put_bytes(int attr, const void *data, int len);
 };
 
 } // namespace nl
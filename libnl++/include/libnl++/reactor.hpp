@@ -0,0 +1,136 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <libnl++/socket.hpp>
+#include <libnl++/wlanapp_common.hpp>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace nl {
+
+/*
+ * Single-threaded event loop that multiplexes many netlink sockets (any
+ * protocol or port), timers and arbitrary user file descriptors over epoll.
+ *
+ * Registered sockets are switched to non-blocking mode. When a socket becomes
+ * readable it is drained with Socket::recv_pending() using a per-wakeup batch
+ * budget, so one busy socket can't starve the others. Handlers run on the
+ * thread calling run()/run_once(); only stop() may be called from another
+ * thread.
+ */
+class Reactor {
+public:
+  using fd_handler_t = std::function<void(u32 events)>;
+  using timer_handler_t = std::function<void()>;
+
+private:
+  enum class EntryKind : u8 { SOCKET, TIMER, USER_FD, WAKEUP, FLUSH_TIMER };
+
+  struct Entry {
+    EntryKind kind;
+    Socket *sock = nullptr;
+    fd_handler_t fd_handler;
+    timer_handler_t timer_handler;
+    // tells events of this registration apart from those of an earlier one
+    // of the same fd number, which may still be in the current batch
+    u32 generation = 0;
+  };
+
+  static constexpr int MAX_EVENTS = 64;
+
+  int epoll_fd = -1;
+  int wakeup_fd = -1;
+  int batch_budget;
+  std::atomic<bool> stopped{false};
+  bool dispatching = false;
+  u32 next_generation = 0;
+  // entries are heap allocated so a handler's entry outlives its removal
+  // while the handler is running
+  std::unordered_map<int, std::unique_ptr<Entry>> entries;
+  // entries removed during dispatch, freed once the batch is done
+  std::vector<std::unique_ptr<Entry>> removed_entries;
+
+  /*
+   * epoll_ctl wrapper, throws on failure
+   */
+  void _ctl(int op, int fd, u32 events, u32 generation = 0);
+
+  /*
+   * Register an entry with epoll. The fd number may be reused right after
+   * its previous entry was removed, even by a handler of the current batch.
+   */
+  void _add_entry(int fd, u32 events, Entry entry);
+
+  /*
+   * Drop an entry; its memory is kept until the end of the current batch
+   */
+  void _remove_entry(int fd);
+
+  void _dispatch(u64 key, u32 events);
+
+public:
+  /*
+   * Reactor ctor.
+   * @arg batch_budget - max number of datagrams drained from one socket per
+   * wakeup
+   */
+  explicit Reactor(int batch_budget = 64);
+  ~Reactor();
+
+  Reactor(const Reactor &other) = delete;
+  Reactor &operator=(const Reactor &other) = delete;
+
+  /*
+   * Watch a socket, switching it into non-blocking mode. If coalescing is
+   * enabled on it, its flush timer is watched too.
+   * @param sock - socket to watch, must outlive its registration
+   * @param cb_ctx_pair - callback and callback argument invoked for every
+   * valid message received on the socket
+   */
+  void add_socket(Socket &sock,
+                  const std::pair<NetlinkValidCallback, void *> &cb_ctx_pair);
+  void remove_socket(Socket &sock);
+
+  /*
+   * Watch an arbitrary file descriptor.
+   * @param fd - descriptor to watch, the reactor doesn't take ownership
+   * @param events - epoll event mask (EPOLLIN, EPOLLOUT, ...)
+   * @param handler - invoked with the ready event mask
+   */
+  void add_fd(int fd, u32 events, fd_handler_t handler);
+  void remove_fd(int fd);
+
+  /*
+   * Arm a timer backed by a timerfd.
+   * @param timeout - delay before the first expiration
+   * @param handler - invoked on expiration
+   * @param periodic - re-arm with the same interval after every expiration
+   * @return timer id to be passed to cancel_timer()
+   */
+  int add_timer(std::chrono::microseconds timeout, timer_handler_t handler,
+                bool periodic = false);
+  void cancel_timer(int timer_id);
+
+  /*
+   * Wait for events once and dispatch them.
+   * @param timeout_ms - epoll_wait timeout, -1 to wait indefinitely
+   * @return number of dispatched events
+   */
+  int run_once(int timeout_ms = -1);
+
+  /*
+   * Dispatch events until stop() is called.
+   */
+  void run();
+
+  /*
+   * Make run() return; safe to call from any thread or from a handler. If
+   * run() isn't running yet, the next call returns right away.
+   */
+  void stop();
+};
+
+} // namespace nl
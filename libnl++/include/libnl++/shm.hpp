@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <libnl++/wlanapp_common.hpp>
+#include <optional>
+#include <sys/types.h>
+
+namespace nl {
+
+/*
+ * Location of a payload stored in a ShmRing. This is what travels over
+ * netlink instead of the payload bytes.
+ */
+struct ShmDescriptor {
+  u64 position; // bytes produced before the payload, never wraps
+  u32 length;   // payload length in bytes
+  u32 reserved; // zero
+};
+
+/*
+ * Single-producer single-consumer byte ring in a memfd shared between two
+ * processes. Netlink stays the control plane: the producer passes its memfd
+ * number once, the consumer duplicates it with pidfd_getfd() and maps the
+ * same memory, and from then on requests carry only ShmDescriptors.
+ *
+ * Payloads are stored contiguously; a payload that doesn't fit before the end
+ * of the data area starts over at offset zero. The consumer must release
+ * payloads in the order they were written.
+ */
+class ShmRing {
+  struct Header {
+    u64 magic;
+    u64 capacity;
+    alignas(64) std::atomic<u64> head; // bytes produced, never wraps
+    alignas(64) std::atomic<u64> tail; // bytes released by the consumer
+  };
+
+  static constexpr u64 MAGIC = 0x676e6c73686d7267; // "gnlshmrg"
+
+  int memfd = -1;
+  // pidfd of the producer, consumer side only
+  int owner_pidfd = -1;
+  size_t map_size = 0;
+  // size of the data area, fixed when the ring is created or attached; the
+  // copy in the header is writable by the peer and is never trusted
+  u64 cap = 0;
+  Header *hdr = nullptr;
+  u8 *data = nullptr;
+
+  ShmRing(int memfd, size_t map_size);
+  void _unmap();
+
+public:
+  /*
+   * Create a new ring backed by a sealed memfd (producer side).
+   * @param capacity - size of the data area in bytes
+   */
+  static ShmRing create(size_t capacity);
+
+  /*
+   * Map a ring created by another process (consumer side). Requires ptrace
+   * access to the producer, i.e. the same user and, with Yama's ptrace_scope
+   * set, CAP_SYS_PTRACE.
+   * @param pid - pid of the producer process, take it from the sender's
+   * credentials rather than from the message
+   * @param fd - memfd number in the producer process
+   * @throws std::runtime_error if fd isn't a sealed shared ring
+   */
+  static ShmRing attach(pid_t pid, int fd);
+
+  ShmRing(ShmRing &&other) noexcept;
+  ShmRing &operator=(ShmRing &&other) noexcept;
+  ShmRing(const ShmRing &other) = delete;
+  ShmRing &operator=(const ShmRing &other) = delete;
+  ~ShmRing();
+
+  int fd() const { return memfd; }
+  size_t capacity() const { return cap; }
+
+  /*
+   * Check whether the producer process still exists (consumer side). A
+   * producer that exits without detaching leaves the mapping behind, this
+   * tells the consumer it can drop it. Always true on the producer side.
+   */
+  bool owner_alive() const;
+
+  /*
+   * Copy a payload into the ring (producer side).
+   * @return descriptor to send to the consumer, or nullopt if the ring doesn't
+   * have enough free space until the consumer releases older payloads
+   */
+  std::optional<ShmDescriptor> write(const void *payload, u32 length);
+
+  /*
+   * Resolve a descriptor into payload memory (consumer side). The memory stays
+   * valid until the descriptor is released.
+   * @throws std::invalid_argument if the descriptor is out of bounds, refers
+   * to memory that was already released or the peer corrupted the ring
+   * indices
+   */
+  const u8 *read(const ShmDescriptor &desc) const;
+
+  /*
+   * Give payload memory back to the producer (consumer side).
+   */
+  void release(const ShmDescriptor &desc);
+};
+
+} // namespace nl
@@ -1,13 +1,17 @@
 #pragma once
 #include <libnl++/callback.hpp>
+#include <libnl++/capture.hpp>
 #include <libnl++/common.hpp>
 #include <libnl++/message.hpp>
+#include <libnl++/transport.hpp>
 #include <libnl++/wlanapp_common.hpp>
+#include <chrono>
 #include <memory>
 #include <netlink/genl/ctrl.h>
 #include <netlink/genl/genl.h>
 #include <netlink/netlink.h>
 #include <spdlog/spdlog.h>
+#include <vector>
 
 /*struct nl_sock;*/
 
@@ -20,21 +24,63 @@ public:
 
 using nlsock_unique_ptr = std::unique_ptr<struct nl_sock, NlSockDeleter>;
 
+/*
+ * Pending messages of a socket with send coalescing enabled.
+ */
+struct TxCoalescing {
+  bool enabled = false;
+  size_t max_bytes = 0;
+  std::chrono::microseconds max_delay{0};
+  std::vector<u8> pending; // complete netlink messages, back to back
+  size_t pending_msgs = 0;
+  std::chrono::steady_clock::time_point oldest_pending{};
+  // timerfd armed for max_delay when a new datagram is started, only while
+  // an event loop watches it
+  int timer_fd = -1;
+  bool timer_watched = false;
+  bool timer_armed = false;
+};
+
 class Socket {
 protected:
+  int nl_protocol;
   nlsock_unique_ptr nlsock;
+  std::unique_ptr<Transport> transport;
   NetlinkCallbackSet nlcbs;
+  TxCoalescing tx_coalescing;
+  // optional tap recording every sent and received datagram
+  std::shared_ptr<CaptureWriter> capture;
 
   /*
-   * Libnl wrapper: creates netlink socket and connects to a given protocol.
+   * Libnl wrapper: creates netlink socket, the transport connects it.
    */
-  static nlsock_unique_ptr _create_nl_socket(int protocol, u32 port = 0);
+  static nlsock_unique_ptr _create_nl_socket();
 
   /*
    * Libnl wrapper: send netlink message
    */
   void _send_msg_auto(Message &nlmsg);
 
+  /*
+   * Pass a sent datagram to the capture tap and the trace ring
+   */
+  void _tap_tx(const void *data, size_t len);
+
+  /*
+   * Append a message to the pending datagram, flushing as needed
+   */
+  void _send_msg_coalesced(Message &nlmsg);
+
+  /*
+   * Arm the coalescing timer to expire after the given delay
+   */
+  void _arm_flush_timer(std::chrono::microseconds delay);
+
+  /*
+   * Stop the coalescing timer, e.g. once the pending datagram was sent
+   */
+  void _disarm_flush_timer();
+
   /*
    * Libnl wrapper: add group membership (for multicast groups)
    */
@@ -64,38 +110,180 @@ public:
    * @arg port - port to bind socket on, if equal to zero libnl chooses port by
    */
   Socket(int nl_protocol, u32 port = 0)
-      : nlsock(_create_nl_socket(nl_protocol, port)) {
-    _set_default_callbacks();
-  }
+      : Socket(std::make_unique<KernelTransport>(), nl_protocol, port) {}
+
+  /*
+   * Socket ctor with a custom transport, e.g. LoopbackTransport.
+   * @arg transport - moves the datagrams of this socket
+   * @arg nl_protocol - netlink protocol to use
+   * @arg port - port to bind socket on, if equal to zero libnl chooses port by
+   */
+  Socket(std::unique_ptr<Transport> transport, int nl_protocol, u32 port = 0);
+
+  /*
+   * Socket dtor: sends out messages still pending in the coalescing queue.
+   */
+  ~Socket();
 
   void set_local_port(u32 port) { _set_local_port(port); }
 
   void set_peer_port(u32 port) { _set_peer_port(port); }
 
   /*
-   * Send netlink message.
-   * @param nlmsg Netlink message
+   * Underlying file descriptor, e.g. to wait for readiness with poll/epoll.
    */
-  void send_msg(Message &nlmsg) { _send_msg_auto(nlmsg); }
+  int fd() const { return transport->fd(); }
 
   /*
-   * Receive netlink message.
-   * @param cb_ctx_pair a pair of callback and callback argument if received for
-   * a valid response
+   * Switch the socket between blocking and non-blocking mode. In non-blocking
+   * mode recv_msg() must not be used, see recv_pending().
    */
-  void recv_msg(const std::pair<NetlinkValidCallback, void *> &cb_ctx_pair) {
+  void set_nonblocking(bool nonblocking = true) {
+    transport->set_nonblocking(nonblocking);
+  }
+
+  bool is_nonblocking() const { return transport->is_nonblocking(); }
+
+  /*
+   * Set callback and callback argument invoked for every valid message
+   * received by recv_msg() or recv_pending().
+   */
+  void set_recv_handler(
+      const std::pair<NetlinkValidCallback, void *> &cb_ctx_pair) {
     recv_ctx.valid_cb_ctx_pair = cb_ctx_pair;
-    recv_ctx.nl_recv_status = RecvStatus::CONTINUE;
-    while (recv_ctx.nl_recv_status == RecvStatus::CONTINUE) {
-      spdlog::debug("starting recv()");
-      int res = nl_recvmsgs(nlsock.get(), nlcbs.get());
-      if (res != 0) {
-        spdlog::error("nl_recvmsgs() failed with code {}");
-        // nl_recv_status is updated in the callback itself
-      }
+  }
+
+  /*
+   * Send netlink message. With coalescing enabled the message may be queued
+   * and sent later as part of a bigger datagram.
+   * @param nlmsg Netlink message
+   */
+  void send_msg(Message &nlmsg) {
+    if (tx_coalescing.enabled) {
+      _send_msg_coalesced(nlmsg);
+    } else {
+      _send_msg_auto(nlmsg);
     }
   }
 
+  /*
+   * Send netlink message right away, after any messages still pending in
+   * the coalescing queue.
+   * @return false if the socket is non-blocking and the peer's receive
+   * buffer is full, the message can be retried later
+   */
+  bool try_send_msg(Message &nlmsg);
+
+  /*
+   * Coalesce sent messages into one datagram to save syscalls under bursty
+   * load. Pending messages are sent once they reach max_bytes, once the
+   * oldest of them has been waiting for max_delay, before the peer port
+   * changes, before receiving (so a request is never stuck behind the wait
+   * for its response), or on flush().
+   *
+   * The max_delay deadline is checked on every send and enforced by the
+   * flush_timer_fd() timer, which a Reactor watches for sockets added after
+   * coalescing was enabled; other event loops must call watch_flush_timer()
+   * and then handle_flush_timer() when it becomes readable.
+   * @param max_bytes - datagram size that triggers a flush
+   * @param max_delay - max time a message may wait in the queue
+   */
+  void enable_coalescing(size_t max_bytes,
+                         std::chrono::microseconds max_delay);
+
+  /*
+   * Flush pending messages and go back to one datagram per message.
+   */
+  void disable_coalescing();
+
+  /*
+   * Send all pending messages now.
+   */
+  void flush();
+
+  /*
+   * Flush if the oldest pending message has been waiting for max_delay.
+   * Meant to be driven by a timer, e.g. Reactor::add_timer().
+   * @return true if a datagram was sent
+   */
+  bool flush_if_due();
+
+  /*
+   * Timer that expires when pending messages are due, -1 if coalescing was
+   * never enabled.
+   */
+  int flush_timer_fd() const { return tx_coalescing.timer_fd; }
+
+  /*
+   * Tell the socket whether an event loop watches flush_timer_fd(). The
+   * timer is only armed while one does, otherwise the deadline is only
+   * checked on send.
+   */
+  void watch_flush_timer(bool watched);
+
+  /*
+   * Consume an expiration of flush_timer_fd() and flush if due.
+   */
+  void handle_flush_timer();
+
+  size_t pending_msgs() const { return tx_coalescing.pending_msgs; }
+
+  /*
+   * Send a raw datagram (one or more complete netlink messages) to the peer
+   * port, e.g. to replay a capture.
+   * @return false if the socket is non-blocking and the peer's receive
+   * buffer is full
+   */
+  bool send_raw(const void *buf, size_t len);
+
+  /*
+   * Record traffic of this socket, pass nullptr to stop recording. Sent
+   * datagrams are recorded as is, received ones one message per record. One
+   * writer may be shared by several sockets.
+   */
+  void set_capture(std::shared_ptr<CaptureWriter> writer) {
+    capture = std::move(writer);
+  }
+
+  /*
+   * Attach the sender's credentials to received messages, so handlers can
+   * tell who sent them with nlmsg_get_creds(). Unlike the source port they
+   * are filled in by the kernel and can't be forged by the sender.
+   */
+  void set_passcred(bool enable = true);
+
+  /*
+   * Size the receive and send buffers. A datagram bigger than the send
+   * buffer fails with EMSGSIZE, libnl's default is 32 KiB.
+   * @param rxbuf - receive buffer size in bytes, 0 for libnl's default
+   * @param txbuf - send buffer size in bytes, 0 for libnl's default
+   */
+  void set_buffer_size(int rxbuf, int txbuf);
+
+  /*
+   * Enable or disable NLM_F_ACK on sent messages, i.e. whether the peer is
+   * asked to answer them.
+   */
+  void set_auto_ack(bool enable);
+
+  /*
+   * Receive netlink message. Pending coalesced messages are flushed first,
+   * like they are by recv_pending().
+   * @param cb_ctx_pair a pair of callback and callback argument if received for
+   * a valid response
+   */
+  void recv_msg(const std::pair<NetlinkValidCallback, void *> &cb_ctx_pair);
+
+  /*
+   * Process datagrams already queued on a non-blocking socket without
+   * waiting for new ones. Messages are passed to the handler set with
+   * set_recv_handler().
+   * @param budget - max number of datagrams to process in one call
+   * @return number of datagrams processed; less than budget means the socket
+   * has been drained
+   */
+  int recv_pending(int budget);
+
   // /*
   //  * Create an event socket into an event socket.
   //  * @param multicast_group_name multicast group you want to join
@@ -132,6 +320,9 @@ public:
                                      struct nlmsgerr *err, void *arg);
     static int default_seq_disable(struct nl_msg *msg, void *arg);
     static int response_handler_wrapper(struct nl_msg *msg, void *arg);
+    static int capture_handler(struct nl_msg *msg, void *arg);
+    static int transport_recv(struct nl_sock *sk, struct sockaddr_nl *nla,
+                              unsigned char **buf, struct ucred **creds);
   };
 };
 
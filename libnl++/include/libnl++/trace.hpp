@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <libnl++/capture.hpp>
+#include <libnl++/wlanapp_common.hpp>
+
+namespace nl {
+namespace trace {
+
+/*
+ * In-memory flight recorder for netlink traffic.
+ *
+ * Every thread records into its own fixed-size ring, so recording is a
+ * handful of relaxed stores and a memcpy of up to SNAPLEN bytes, without
+ * locks or allocations (except for the first record of a thread). Slots are
+ * protected by per-slot sequence counters, so dump() may read the rings of
+ * all threads concurrently with writers, including from a signal handler.
+ * Rings of exited threads are kept, so their last records stay available
+ * for post-mortem dumps. Only once MAX_RINGS rings exist do new threads take
+ * over the rings of exited ones, overwriting their records.
+ */
+
+// bytes of each datagram kept in the ring
+constexpr size_t SNAPLEN = 256;
+// records kept per thread
+constexpr size_t RING_SLOTS = 1024;
+// max number of rings, threads beyond that many live ones aren't traced
+constexpr size_t MAX_RINGS = 64;
+
+extern std::atomic<bool> enabled;
+
+void record_slow(CaptureDirection dir, u32 port, const void *data, size_t len);
+
+/*
+ * Record a datagram into the calling thread's ring if tracing is enabled.
+ * @param dir - whether the datagram was received or sent
+ * @param port - netlink port of the peer
+ */
+inline void record(CaptureDirection dir, u32 port, const void *data,
+                   size_t len) {
+  if (enabled.load(std::memory_order_relaxed)) {
+    record_slow(dir, port, data, len);
+  }
+}
+
+inline void enable(bool on = true) {
+  enabled.store(on, std::memory_order_relaxed);
+}
+
+/*
+ * Write the records of all rings, oldest first, as text with hex dumps of
+ * the captured bytes. Async-signal-safe: uses only write(2) and stack
+ * buffers.
+ * @param fd - file descriptor to write to
+ */
+void dump(int fd);
+
+/*
+ * Dump all rings to stderr when the process crashes (SIGSEGV, SIGBUS,
+ * SIGFPE, SIGILL, SIGABRT), then let the default action run.
+ */
+void install_crash_handler();
+
+/*
+ * Dump all rings to stderr whenever the given signal is received.
+ */
+void install_dump_signal(int signum);
+
+} // namespace trace
+} // namespace nl
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <libnl++/wlanapp_common.hpp>
+#include <netlink/netlink.h>
+
+namespace nl {
+
+/*
+ * Datagram I/O underneath an nl::Socket. The libnl socket keeps ports,
+ * sequence numbers and flags and libnl still completes outgoing and parses
+ * incoming messages, a transport only moves complete datagrams (one or more
+ * netlink messages back to back) between ports.
+ *
+ * Return values follow libnl: byte counts on success, negative NLE_* codes
+ * on failure and -NLE_AGAIN when a non-blocking operation would block.
+ */
+class Transport {
+protected:
+  // owned by the Socket this transport is attached to
+  struct nl_sock *nlsock = nullptr;
+
+public:
+  virtual ~Transport() = default;
+
+  /*
+   * Bind the transport to a Socket, called once by the Socket ctor.
+   * @arg sk - libnl socket of the Socket
+   * @arg nl_protocol - netlink protocol to use
+   * @arg port - local port, zero to let libnl choose one
+   */
+  virtual void attach(struct nl_sock *sk, int nl_protocol, u32 port) = 0;
+
+  /*
+   * File descriptor that is readable while datagrams are pending.
+   */
+  virtual int fd() const = 0;
+
+  virtual void set_nonblocking(bool nonblocking) = 0;
+
+  virtual bool is_nonblocking() const = 0;
+
+  virtual void set_local_port(u32 port) = 0;
+
+  virtual int add_membership(int multicast_group_id) = 0;
+
+  /*
+   * Deliver the sender's credentials with received datagrams.
+   */
+  virtual int set_passcred(bool enable) = 0;
+
+  /*
+   * Size the kernel's socket buffers, which bound the size of a single
+   * datagram; zero keeps libnl's default.
+   */
+  virtual int set_buffer_size(int rxbuf, int txbuf) = 0;
+
+  /*
+   * Send a datagram to the peer port of the libnl socket.
+   */
+  virtual int send(const void *buf, size_t len) = 0;
+
+  /*
+   * Receive one datagram, same contract as nl_recv(): on success *buf points
+   * to a malloc()ed buffer the caller frees and src holds the sender. If
+   * credential passing is enabled and creds isn't null, *creds is set to the
+   * sender's malloc()ed credentials.
+   */
+  virtual int recv(struct sockaddr_nl *src, unsigned char **buf,
+                   struct ucred **creds) = 0;
+};
+
+/*
+ * Default transport: a real netlink socket in the kernel.
+ */
+class KernelTransport : public Transport {
+public:
+  void attach(struct nl_sock *sk, int nl_protocol, u32 port) override;
+  int fd() const override;
+  void set_nonblocking(bool nonblocking) override;
+  bool is_nonblocking() const override;
+  void set_local_port(u32 port) override;
+  int add_membership(int multicast_group_id) override;
+  int set_passcred(bool enable) override;
+  int set_buffer_size(int rxbuf, int txbuf) override;
+  int send(const void *buf, size_t len) override;
+  int recv(struct sockaddr_nl *src, unsigned char **buf,
+           struct ucred **creds) override;
+};
+
+} // namespace nl
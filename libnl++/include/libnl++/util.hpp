@@ -6,4 +6,24 @@ namespace nl {
 void hexdump(const void *data, std::size_t length,
              std::size_t bytes_per_line = 16);
 
-}
+/*
+ * Number of characters format_hexdump() produces for the given input.
+ */
+std::size_t hexdump_size(std::size_t length, std::size_t bytes_per_line = 16);
+
+/*
+ * Render a canonical hex+ASCII dump (the same layout hexdump() prints) into a
+ * caller-provided buffer. Doesn't allocate and doesn't lock, so it can be
+ * used on hot paths and from signal handlers. Lines of 16 bytes are converted
+ * with SIMD where available.
+ * @param out - output buffer, not NUL-terminated
+ * @param out_size - output buffer size; only complete lines that fit are
+ * written
+ * @param base_offset - offset printed for the first line
+ * @return number of characters written
+ */
+std::size_t format_hexdump(char *out, std::size_t out_size, const void *data,
+                           std::size_t length, std::size_t bytes_per_line = 16,
+                           std::size_t base_offset = 0);
+
+} // namespace nl
@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <libnl++/capture.hpp>
+#include <linux/if_arp.h>
+#include <linux/if_packet.h>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nl {
+
+namespace {
+
+constexpr u32 PCAP_MAGIC_USEC = 0xa1b2c3d4;
+constexpr u32 PCAP_MAGIC_NSEC = 0xa1b23c4d;
+constexpr u32 LINKTYPE_NETLINK = 253;
+constexpr u32 SNAPLEN = 256 * 1024;
+constexpr size_t GROW_CHUNK = 4 * 1024 * 1024;
+
+struct PcapFileHeader {
+  u32 magic;
+  u16 version_major;
+  u16 version_minor;
+  i32 thiszone;
+  u32 sigfigs;
+  u32 snaplen;
+  u32 linktype;
+};
+
+struct PcapRecordHeader {
+  u32 ts_sec;
+  u32 ts_frac; // nanoseconds or microseconds, depending on the file magic
+  u32 incl_len;
+  u32 orig_len;
+};
+
+// Linux cooked capture header nlmon prepends to every netlink datagram, all
+// fields are big endian
+struct SllHeader {
+  u16 pkttype;
+  u16 hatype;
+  u16 addr_len;
+  u8 addr[8];
+  u16 protocol;
+};
+static_assert(sizeof(SllHeader) == 16);
+
+} // namespace
+
+CaptureWriter::CaptureWriter(const std::string &path) {
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw std::runtime_error(fmt::format("Failed to open capture file {}: {}",
+                                         path, strerror(errno)));
+  }
+  PcapFileHeader hdr = {.magic = PCAP_MAGIC_NSEC,
+                        .version_major = 2,
+                        .version_minor = 4,
+                        .thiszone = 0,
+                        .sigfigs = 0,
+                        .snaplen = SNAPLEN,
+                        .linktype = LINKTYPE_NETLINK};
+  try {
+    _reserve(sizeof(hdr));
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  memcpy(map, &hdr, sizeof(hdr));
+  used = sizeof(hdr);
+  spdlog::debug("Capturing netlink traffic to {}", path);
+}
+
+CaptureWriter::~CaptureWriter() {
+  if (map != nullptr) {
+    munmap(map, mapped);
+  }
+  // drop the preallocated tail of the last chunk
+  if (ftruncate(fd, static_cast<off_t>(used)) != 0) {
+    spdlog::error("Failed to truncate capture file: {}", strerror(errno));
+  }
+  close(fd);
+}
+
+void CaptureWriter::_reserve(size_t bytes) {
+  if (used + bytes <= mapped) {
+    return;
+  }
+  size_t new_size = std::max(mapped * 2, used + bytes + GROW_CHUNK);
+  new_size = (new_size + GROW_CHUNK - 1) / GROW_CHUNK * GROW_CHUNK;
+  // allocate the blocks up front: writing through the mapping into a hole
+  // of a full filesystem would SIGBUS instead of failing here
+  int err = posix_fallocate(fd, static_cast<off_t>(mapped),
+                            static_cast<off_t>(new_size - mapped));
+  if (err != 0) {
+    throw std::runtime_error(
+        fmt::format("Failed to grow capture file: {}", strerror(err)));
+  }
+  void *addr = map == nullptr ? mmap(nullptr, new_size, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED, fd, 0)
+                              : mremap(map, mapped, new_size, MREMAP_MAYMOVE);
+  if (addr == MAP_FAILED) {
+    throw std::runtime_error(
+        fmt::format("Failed to map capture file: {}", strerror(errno)));
+  }
+  map = static_cast<u8 *>(addr);
+  mapped = new_size;
+}
+
+void CaptureWriter::write(CaptureDirection dir, int nl_protocol,
+                          const void *data, size_t len) {
+  size_t incl_len = std::min<size_t>(len, SNAPLEN - sizeof(SllHeader));
+  _reserve(sizeof(PcapRecordHeader) + sizeof(SllHeader) + incl_len);
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  PcapRecordHeader rec = {
+      .ts_sec = static_cast<u32>(ts.tv_sec),
+      .ts_frac = static_cast<u32>(ts.tv_nsec),
+      .incl_len = static_cast<u32>(sizeof(SllHeader) + incl_len),
+      .orig_len = static_cast<u32>(sizeof(SllHeader) + len)};
+  SllHeader sll = {};
+  sll.pkttype = htons(dir == CaptureDirection::TX ? PACKET_OUTGOING
+                                                  : PACKET_HOST);
+  sll.hatype = htons(ARPHRD_NETLINK);
+  sll.protocol = htons(static_cast<u16>(nl_protocol));
+
+  u8 *out = map + used;
+  memcpy(out, &rec, sizeof(rec));
+  memcpy(out + sizeof(rec), &sll, sizeof(sll));
+  memcpy(out + sizeof(rec) + sizeof(sll), data, incl_len);
+  used += sizeof(rec) + sizeof(sll) + incl_len;
+}
+
+CaptureReader::CaptureReader(const std::string &path) {
+  fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error(fmt::format("Failed to open capture file {}: {}",
+                                         path, strerror(errno)));
+  }
+  struct stat st = {};
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(PcapFileHeader)) {
+    close(fd);
+    throw std::runtime_error(
+        fmt::format("{} is too short to be a capture file", path));
+  }
+  file_size = static_cast<size_t>(st.st_size);
+  void *addr = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    int err = errno;
+    close(fd);
+    throw std::runtime_error(
+        fmt::format("Failed to map capture file {}: {}", path, strerror(err)));
+  }
+  map = static_cast<const u8 *>(addr);
+  madvise(addr, file_size, MADV_SEQUENTIAL);
+
+  PcapFileHeader hdr;
+  memcpy(&hdr, map, sizeof(hdr));
+  if ((hdr.magic != PCAP_MAGIC_NSEC && hdr.magic != PCAP_MAGIC_USEC) ||
+      hdr.linktype != LINKTYPE_NETLINK) {
+    munmap(addr, file_size);
+    close(fd);
+    throw std::runtime_error(
+        fmt::format("{} is not a netlink pcap capture", path));
+  }
+  nsec_timestamps = hdr.magic == PCAP_MAGIC_NSEC;
+  pos = sizeof(hdr);
+}
+
+CaptureReader::~CaptureReader() {
+  munmap(const_cast<u8 *>(map), file_size);
+  close(fd);
+}
+
+std::optional<CaptureReader::Record> CaptureReader::next() {
+  while (pos + sizeof(PcapRecordHeader) <= file_size) {
+    PcapRecordHeader rec;
+    memcpy(&rec, map + pos, sizeof(rec));
+    if (rec.incl_len == 0 && rec.ts_sec == 0) {
+      // zeroed tail left behind by a writer that didn't shut down cleanly
+      return std::nullopt;
+    }
+    const u8 *payload = map + pos + sizeof(rec);
+    if (rec.incl_len > file_size - pos - sizeof(rec)) {
+      spdlog::warn("Capture is truncated at offset {}", pos);
+      return std::nullopt;
+    }
+    pos += sizeof(rec) + rec.incl_len;
+    if (rec.incl_len < sizeof(SllHeader)) {
+      continue;
+    }
+    SllHeader sll;
+    memcpy(&sll, payload, sizeof(sll));
+    auto frac = std::chrono::nanoseconds(
+        nsec_timestamps ? rec.ts_frac : rec.ts_frac * 1000ULL);
+    return Record{
+        .timestamp = std::chrono::seconds(rec.ts_sec) + frac,
+        .dir = ntohs(sll.pkttype) == PACKET_OUTGOING ? CaptureDirection::TX
+                                                      : CaptureDirection::RX,
+        .nl_protocol = ntohs(sll.protocol),
+        .data = payload + sizeof(sll),
+        .len = rec.incl_len - sizeof(sll),
+        .orig_len = std::max(rec.orig_len, rec.incl_len) - sizeof(sll)};
+  }
+  return std::nullopt;
+}
+
+void CaptureReader::rewind() { pos = sizeof(PcapFileHeader); }
+
+} // namespace nl
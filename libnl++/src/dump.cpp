@@ -0,0 +1,94 @@
+#include <cstring>
+#include <libnl++/dump.hpp>
+#include <netlink/genl/genl.h>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+namespace nl {
+
+DumpWriter::DumpWriter(Socket &sock, u8 nl_cmd, int family_id, u32 seq,
+                       int cursor_attr, size_t target_size,
+                       size_t max_record_size)
+    : sock{sock}, nl_cmd{nl_cmd}, family_id{family_id}, seq{seq},
+      cursor_attr{cursor_attr}, target_size{target_size},
+      // a message may exceed target_size by up to one record plus the cursor
+      msg{NLMSG_HDRLEN + GENL_HDRLEN + target_size + max_record_size +
+          static_cast<size_t>(nla_total_size(sizeof(u64)))} {
+  _start_msg();
+}
+
+DumpWriter::~DumpWriter() {
+  if (!finished) {
+    spdlog::debug("Dump abandoned after {} records", total_records);
+  }
+}
+
+void DumpWriter::_start_msg() {
+  msg.reset();
+  msg.put_header(nl_cmd, family_id, 0, seq).add_flags(NLM_F_MULTI);
+  records_in_msg = 0;
+}
+
+void DumpWriter::_seal_msg() {
+  msg.put_attr<u64>(cursor_attr, cursor);
+  held = true;
+}
+
+void DumpWriter::_queue_done() {
+  msg.reset();
+  struct nlmsghdr *hdr =
+      nlmsg_put(msg.get(), 0, seq, NLMSG_DONE, sizeof(int), NLM_F_MULTI);
+  if (hdr == nullptr) {
+    throw std::bad_alloc();
+  }
+  memset(nlmsg_data(hdr), 0, sizeof(int));
+  done_queued = true;
+  held = true;
+}
+
+bool DumpWriter::flush() {
+  while (held) {
+    if (!sock.try_send_msg(msg)) {
+      return false;
+    }
+    held = false;
+    if (done_queued) {
+      finished = true;
+      spdlog::debug("Dump finished: {} records in {} messages", total_records,
+                    total_msgs);
+      break;
+    }
+    total_msgs++;
+    if (finishing) {
+      _queue_done();
+    } else {
+      _start_msg();
+    }
+  }
+  return true;
+}
+
+bool DumpWriter::end_record(u64 next_cursor) {
+  cursor = next_cursor;
+  records_in_msg++;
+  total_records++;
+  if (nlmsg_hdr(msg.get())->nlmsg_len >= target_size) {
+    _seal_msg();
+    return flush();
+  }
+  return true;
+}
+
+bool DumpWriter::finish() {
+  if (!finishing) {
+    finishing = true;
+    if (records_in_msg > 0) {
+      _seal_msg();
+    } else {
+      _queue_done();
+    }
+  }
+  return flush();
+}
+
+} // namespace nl
@@ -0,0 +1,295 @@
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <libnl++/loopback.hpp>
+#include <netlink/errno.h>
+#include <netlink/socket.h>
+#include <poll.h>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace nl {
+
+/*
+ * Bounded multi-producer single-consumer queue of datagrams (Vyukov's
+ * per-cell sequence scheme) with an eventfd for sleeping consumers.
+ *
+ * To keep syscalls off the fast path the consumer "arms" the queue when it
+ * finds it empty and only the first producer to see it armed signals the
+ * eventfd, so the eventfd is only readable while the queue is disarmed. Both
+ * sides publish their own step before checking the other's (push before
+ * armed, armed before re-checking the queue) with seq_cst ordering, so a push
+ * can't slip in between unnoticed.
+ */
+class LoopbackQueue {
+public:
+  struct Datagram {
+    unsigned char *buf; // malloc()ed, ownership moves to the receiver
+    u32 len;
+    u32 src_port;
+    struct ucred creds;
+  };
+
+private:
+  struct alignas(64) Cell {
+    std::atomic<size_t> seq;
+    Datagram datagram;
+  };
+
+  std::vector<Cell> cells;
+  size_t mask;
+  alignas(64) std::atomic<size_t> enqueue_pos{0};
+  alignas(64) size_t dequeue_pos = 0; // consumer only
+  alignas(64) std::atomic<bool> armed{true};
+  int event_fd = -1;
+
+  void _signal() {
+    u64 one = 1;
+    // can only fail if the counter would overflow, then it is readable anyway
+    (void)!write(event_fd, &one, sizeof(one));
+  }
+
+  bool _pop(Datagram &out) {
+    Cell &cell = cells[dequeue_pos & mask];
+    size_t seq = cell.seq.load(std::memory_order_acquire);
+    if (seq != dequeue_pos + 1) {
+      return false;
+    }
+    out = cell.datagram;
+    cell.seq.store(dequeue_pos + mask + 1, std::memory_order_release);
+    dequeue_pos++;
+    return true;
+  }
+
+public:
+  std::atomic<bool> closed{false};
+
+  explicit LoopbackQueue(size_t slots) {
+    size_t capacity = 2;
+    while (capacity < slots) {
+      capacity <<= 1;
+    }
+    cells = std::vector<Cell>(capacity);
+    mask = capacity - 1;
+    for (size_t i = 0; i < capacity; i++) {
+      cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+    event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (event_fd < 0) {
+      throw std::runtime_error(
+          fmt::format("eventfd failed: {}", strerror(errno)));
+    }
+  }
+
+  ~LoopbackQueue() {
+    Datagram datagram;
+    while (_pop(datagram)) {
+      free(datagram.buf);
+    }
+    close(event_fd);
+  }
+
+  LoopbackQueue(const LoopbackQueue &other) = delete;
+  LoopbackQueue &operator=(const LoopbackQueue &other) = delete;
+
+  int fd() const { return event_fd; }
+
+  /*
+   * @return false if the queue is full
+   */
+  bool push(const Datagram &datagram) {
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+      cell = &cells[pos & mask];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->datagram = datagram;
+    cell->seq.store(pos + 1, std::memory_order_release);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (armed.load(std::memory_order_relaxed) && armed.exchange(false)) {
+      _signal();
+    }
+    return true;
+  }
+
+  /*
+   * Take the oldest datagram, waiting for one unless nonblocking is set.
+   * @return false if nonblocking is set and the queue is empty
+   */
+  bool pop(Datagram &out, bool nonblocking) {
+    for (;;) {
+      if (_pop(out)) {
+        return true;
+      }
+      if (!armed.load(std::memory_order_relaxed)) {
+        // consume the signal of the producer that disarmed the queue; if it
+        // is still in flight, that producer's datagram is found below and the
+        // queue is disarmed again, so the eventfd can't be left readable
+        u64 count;
+        (void)!read(event_fd, &count, sizeof(count));
+        armed.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_pop(out)) {
+          // more may be queued behind it, keep the eventfd readable
+          if (armed.exchange(false)) {
+            _signal();
+          }
+          return true;
+        }
+      }
+      if (nonblocking) {
+        return false;
+      }
+      struct pollfd pfd = {.fd = event_fd, .events = POLLIN, .revents = 0};
+      if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+        throw std::runtime_error(
+            fmt::format("poll failed: {}", strerror(errno)));
+      }
+    }
+  }
+};
+
+void LoopbackHub::bind(u32 port, std::shared_ptr<LoopbackQueue> queue) {
+  std::lock_guard<std::mutex> lock{mutex};
+  if (!ports.emplace(port, std::move(queue)).second) {
+    throw std::runtime_error(
+        fmt::format("Loopback port {} is already bound", port));
+  }
+}
+
+void LoopbackHub::unbind(u32 port, const LoopbackQueue *queue) {
+  std::lock_guard<std::mutex> lock{mutex};
+  auto it = ports.find(port);
+  if (it != ports.end() && it->second.get() == queue) {
+    ports.erase(it);
+  }
+}
+
+std::shared_ptr<LoopbackQueue> LoopbackHub::lookup(u32 port) {
+  std::lock_guard<std::mutex> lock{mutex};
+  auto it = ports.find(port);
+  return it != ports.end() ? it->second : nullptr;
+}
+
+LoopbackTransport::LoopbackTransport(std::shared_ptr<LoopbackHub> hub,
+                                     size_t queue_slots)
+    : hub{std::move(hub)},
+      rx_queue{std::make_shared<LoopbackQueue>(queue_slots)},
+      own_creds{.pid = getpid(), .uid = getuid(), .gid = getgid()} {}
+
+LoopbackTransport::~LoopbackTransport() {
+  rx_queue->closed.store(true, std::memory_order_relaxed);
+  if (nlsock != nullptr) {
+    hub->unbind(nl_socket_get_local_port(nlsock), rx_queue.get());
+  }
+}
+
+void LoopbackTransport::attach(struct nl_sock *sk, int nl_protocol, u32 port) {
+  nlsock = sk;
+  if (port == 0) {
+    // libnl picks a port unique within the process, like it does before
+    // binding a kernel socket
+    port = nl_socket_get_local_port(nlsock);
+  } else {
+    nl_socket_set_local_port(nlsock, port);
+  }
+  hub->bind(port, rx_queue);
+}
+
+int LoopbackTransport::fd() const { return rx_queue->fd(); }
+
+void LoopbackTransport::set_nonblocking(bool nonblocking) {
+  this->nonblocking = nonblocking;
+}
+
+void LoopbackTransport::set_local_port(u32 port) {
+  u32 old_port = nl_socket_get_local_port(nlsock);
+  if (port == old_port) {
+    return;
+  }
+  hub->bind(port, rx_queue);
+  hub->unbind(old_port, rx_queue.get());
+  nl_socket_set_local_port(nlsock, port);
+}
+
+int LoopbackTransport::add_membership(int multicast_group_id) {
+  return -NLE_OPNOTSUPP;
+}
+
+int LoopbackTransport::set_passcred(bool enable) {
+  passcred = enable;
+  return 0;
+}
+
+LoopbackQueue *LoopbackTransport::_peer_queue() {
+  u32 port = nl_socket_get_peer_port(nlsock);
+  if (port != peer_port || !peer_queue ||
+      peer_queue->closed.load(std::memory_order_relaxed)) {
+    peer_port = port;
+    peer_queue = hub->lookup(port);
+  }
+  return peer_queue.get();
+}
+
+int LoopbackTransport::send(const void *buf, size_t len) {
+  LoopbackQueue *queue = _peer_queue();
+  if (queue == nullptr) {
+    return -NLE_OBJ_NOTFOUND;
+  }
+  LoopbackQueue::Datagram datagram{
+      static_cast<unsigned char *>(malloc(len)), static_cast<u32>(len),
+      nl_socket_get_local_port(nlsock), own_creds};
+  if (datagram.buf == nullptr) {
+    return -NLE_NOMEM;
+  }
+  memcpy(datagram.buf, buf, len);
+  while (!queue->push(datagram)) {
+    if (nonblocking || queue->closed.load(std::memory_order_relaxed)) {
+      free(datagram.buf);
+      return nonblocking ? -NLE_AGAIN : -NLE_OBJ_NOTFOUND;
+    }
+    std::this_thread::yield();
+  }
+  return static_cast<int>(len);
+}
+
+int LoopbackTransport::recv(struct sockaddr_nl *src, unsigned char **buf,
+                            struct ucred **creds) {
+  LoopbackQueue::Datagram datagram;
+  if (!rx_queue->pop(datagram, nonblocking)) {
+    return -NLE_AGAIN;
+  }
+  if (passcred && creds != nullptr) {
+    *creds = static_cast<struct ucred *>(malloc(sizeof(**creds)));
+    if (*creds == nullptr) {
+      free(datagram.buf);
+      return -NLE_NOMEM;
+    }
+    **creds = datagram.creds;
+  }
+  memset(src, 0, sizeof(*src));
+  src->nl_family = AF_NETLINK;
+  src->nl_pid = datagram.src_port;
+  *buf = datagram.buf;
+  return static_cast<int>(datagram.len);
+}
+
+} // namespace nl
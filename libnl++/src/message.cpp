@@ -1,5 +1,6 @@
 #include "libnl++/wlanapp_common.hpp"
 #include <cerrno>
+#include <cstring>
 #include <libnl++/message.hpp>
 #include <net/if.h>
 #include <spdlog/spdlog.h>
@@ -21,10 +22,27 @@ nlmsg_unique_ptr Message::create_nlmsg() {
   return nlmsg;
 }
 
-Message &Message::put_header(uint8_t nl_cmd, int family_id, u32 port) {
+nlmsg_unique_ptr Message::create_nlmsg(size_t max_size) {
+  struct nl_msg *nlmsg_raw = nlmsg_alloc_size(max_size);
+  if (nlmsg_raw == nullptr) {
+    throw std::bad_alloc();
+  }
+  nlmsg_unique_ptr nlmsg{nlmsg_raw};
+  return nlmsg;
+}
+
+void Message::reset() {
+  struct nlmsghdr *hdr = nlmsg_hdr(nlmsg.get());
+  memset(hdr, 0, NLMSG_HDRLEN);
+  hdr->nlmsg_len = NLMSG_HDRLEN;
+  nested_attr_start = nullptr;
+}
+
+Message &Message::put_header(uint8_t nl_cmd, int family_id, u32 port,
+                             u32 seq) {
   u8 *hdr_ptr = (u8 *)genlmsg_put(nlmsg.get(),
                                   /* pid= */ port,
-                                  /* seq= */ 0,
+                                  /* seq= */ seq,
                                   /* family= */ family_id,
                                   /* hdrlen= */ 0,
                                   /* flags= */ 0,
@@ -38,6 +56,11 @@ Message &Message::put_header(uint8_t nl_cmd, int family_id, u32 port) {
   return *this;
 }
 
+Message &Message::add_flags(int flags) {
+  nlmsg_hdr(nlmsg.get())->nlmsg_flags |= flags;
+  return *this;
+}
+
 Message &Message::put_vendor_id(u32 vendor_id, int attr_vendor_id) {
   int ret = nla_put(nlmsg.get(), attr_vendor_id, sizeof(u32), &vendor_id);
   if (ret != 0) {
@@ -92,4 +115,13 @@ Message &Message::put_string(int attr, const std::string &data) {
   return *this;
 }
 
+Message &Message::put_bytes(int attr, const void *data, int len) {
+  int res = nla_put(nlmsg.get(), attr, len, data);
+  if (res != 0) {
+    throw std::runtime_error(
+        fmt::format("nla_put failed for attr id {} and {} bytes", attr, len));
+  }
+  return *this;
+}
+
 }; // namespace nl
@@ -0,0 +1,230 @@
+#include <cerrno>
+#include <cstring>
+#include <libnl++/reactor.hpp>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace nl {
+
+Reactor::Reactor(int batch_budget) : batch_budget(batch_budget) {
+  if (batch_budget <= 0) {
+    throw std::invalid_argument("batch_budget must be positive");
+  }
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0) {
+    throw std::runtime_error(
+        fmt::format("epoll_create1 failed: {}", strerror(errno)));
+  }
+  wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wakeup_fd < 0) {
+    int err = errno;
+    close(epoll_fd);
+    throw std::runtime_error(
+        fmt::format("eventfd failed: {}", strerror(err)));
+  }
+  try {
+    _add_entry(wakeup_fd, EPOLLIN, Entry{.kind = EntryKind::WAKEUP});
+  } catch (...) {
+    close(wakeup_fd);
+    close(epoll_fd);
+    throw;
+  }
+}
+
+Reactor::~Reactor() {
+  for (auto &[fd, entry] : entries) {
+    if (entry->kind == EntryKind::TIMER) {
+      close(fd);
+    } else if (entry->kind == EntryKind::FLUSH_TIMER) {
+      try {
+        entry->sock->watch_flush_timer(false);
+      } catch (std::runtime_error &e) {
+        spdlog::warn("Reactor: failed to stop flush timer: {}", e.what());
+      }
+    }
+  }
+  close(wakeup_fd);
+  close(epoll_fd);
+}
+
+void Reactor::_ctl(int op, int fd, u32 events, u32 generation) {
+  struct epoll_event ev = {};
+  ev.events = events;
+  ev.data.u64 = (static_cast<u64>(generation) << 32) | static_cast<u32>(fd);
+  if (epoll_ctl(epoll_fd, op, fd, &ev) != 0) {
+    throw std::runtime_error(
+        fmt::format("epoll_ctl({}) failed for fd {}: {}", op, fd,
+                    strerror(errno)));
+  }
+}
+
+void Reactor::_add_entry(int fd, u32 events, Entry entry) {
+  entry.generation = next_generation++;
+  _ctl(EPOLL_CTL_ADD, fd, events, entry.generation);
+  entries[fd] = std::make_unique<Entry>(std::move(entry));
+}
+
+void Reactor::_remove_entry(int fd) {
+  auto it = entries.find(fd);
+  if (it == entries.end()) {
+    throw std::invalid_argument(
+        fmt::format("fd {} is not registered in reactor", fd));
+  }
+  _ctl(EPOLL_CTL_DEL, fd, 0);
+  if (dispatching) {
+    // the running handler may belong to this entry
+    removed_entries.push_back(std::move(it->second));
+  }
+  entries.erase(it);
+}
+
+void Reactor::add_socket(
+    Socket &sock, const std::pair<NetlinkValidCallback, void *> &cb_ctx_pair) {
+  int fd = sock.fd();
+  sock.set_nonblocking(true);
+  sock.set_recv_handler(cb_ctx_pair);
+  _add_entry(fd, EPOLLIN, Entry{.kind = EntryKind::SOCKET, .sock = &sock});
+  if (sock.flush_timer_fd() >= 0) {
+    _add_entry(sock.flush_timer_fd(), EPOLLIN,
+               Entry{.kind = EntryKind::FLUSH_TIMER, .sock = &sock});
+    sock.watch_flush_timer(true);
+  }
+  spdlog::debug("Reactor: watching netlink socket fd {}", fd);
+}
+
+void Reactor::remove_socket(Socket &sock) {
+  _remove_entry(sock.fd());
+  if (sock.flush_timer_fd() >= 0) {
+    _remove_entry(sock.flush_timer_fd());
+    sock.watch_flush_timer(false);
+  }
+}
+
+void Reactor::add_fd(int fd, u32 events, fd_handler_t handler) {
+  _add_entry(
+      fd, events,
+      Entry{.kind = EntryKind::USER_FD, .fd_handler = std::move(handler)});
+}
+
+void Reactor::remove_fd(int fd) { _remove_entry(fd); }
+
+int Reactor::add_timer(std::chrono::microseconds timeout,
+                       timer_handler_t handler, bool periodic) {
+  int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (tfd < 0) {
+    throw std::runtime_error(
+        fmt::format("timerfd_create failed: {}", strerror(errno)));
+  }
+  // a zero it_value would disarm the timer, fire as soon as possible instead
+  auto usec = std::max<i64>(timeout.count(), 1);
+  struct itimerspec spec = {};
+  spec.it_value.tv_sec = usec / 1000000;
+  spec.it_value.tv_nsec = (usec % 1000000) * 1000;
+  if (periodic) {
+    spec.it_interval = spec.it_value;
+  }
+  if (timerfd_settime(tfd, 0, &spec, nullptr) != 0) {
+    int err = errno;
+    close(tfd);
+    throw std::runtime_error(
+        fmt::format("timerfd_settime failed: {}", strerror(err)));
+  }
+  try {
+    _add_entry(tfd, EPOLLIN,
+               Entry{.kind = EntryKind::TIMER,
+                     .timer_handler = std::move(handler)});
+  } catch (...) {
+    close(tfd);
+    throw;
+  }
+  return tfd;
+}
+
+void Reactor::cancel_timer(int timer_id) {
+  _remove_entry(timer_id);
+  close(timer_id);
+}
+
+void Reactor::_dispatch(u64 key, u32 events) {
+  int fd = static_cast<int>(static_cast<u32>(key));
+  auto it = entries.find(fd);
+  if (it == entries.end() || it->second->generation != key >> 32) {
+    // removed earlier in this batch, maybe with the fd reused meanwhile
+    return;
+  }
+  Entry &entry = *it->second;
+  switch (entry.kind) {
+  case EntryKind::SOCKET: {
+    int processed = entry.sock->recv_pending(batch_budget);
+    if (processed == batch_budget) {
+      spdlog::debug("Reactor: fd {} hit batch budget, rescheduling", fd);
+    }
+    break;
+  }
+  case EntryKind::TIMER: {
+    u64 expirations = 0;
+    if (read(fd, &expirations, sizeof(expirations)) < 0) {
+      // spurious wakeup, the timer hasn't actually expired
+      break;
+    }
+    entry.timer_handler();
+    break;
+  }
+  case EntryKind::FLUSH_TIMER:
+    entry.sock->handle_flush_timer();
+    break;
+  case EntryKind::USER_FD:
+    entry.fd_handler(events);
+    break;
+  case EntryKind::WAKEUP: {
+    u64 counter = 0;
+    (void)read(fd, &counter, sizeof(counter));
+    break;
+  }
+  }
+}
+
+int Reactor::run_once(int timeout_ms) {
+  struct epoll_event events[MAX_EVENTS];
+  int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+  if (n < 0) {
+    if (errno == EINTR) {
+      return 0;
+    }
+    throw std::runtime_error(
+        fmt::format("epoll_wait failed: {}", strerror(errno)));
+  }
+  dispatching = true;
+  try {
+    for (int i = 0; i < n; i++) {
+      _dispatch(events[i].data.u64, events[i].events);
+    }
+  } catch (...) {
+    dispatching = false;
+    removed_entries.clear();
+    throw;
+  }
+  dispatching = false;
+  removed_entries.clear();
+  return n;
+}
+
+void Reactor::run() {
+  while (!stopped.load(std::memory_order_relaxed)) {
+    run_once(-1);
+  }
+  // reset on the way out, so a stop() that comes before run() isn't lost
+  stopped.store(false, std::memory_order_relaxed);
+}
+
+void Reactor::stop() {
+  stopped.store(true, std::memory_order_relaxed);
+  u64 one = 1;
+  (void)write(wakeup_fd, &one, sizeof(one));
+}
+
+} // namespace nl
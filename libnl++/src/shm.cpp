@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <libnl++/shm.hpp>
+#include <poll.h>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+
+namespace nl {
+
+ShmRing::ShmRing(int memfd, size_t map_size)
+    : memfd(memfd), map_size(map_size), cap(map_size - sizeof(Header)) {
+  void *addr =
+      mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+  if (addr == MAP_FAILED) {
+    int err = errno;
+    close(memfd);
+    throw std::runtime_error(
+        fmt::format("mmap of shared ring failed: {}", strerror(err)));
+  }
+  hdr = static_cast<Header *>(addr);
+  data = static_cast<u8 *>(addr) + sizeof(Header);
+}
+
+ShmRing ShmRing::create(size_t capacity) {
+  if (capacity == 0) {
+    throw std::invalid_argument("shared ring capacity must be positive");
+  }
+  int fd = memfd_create("genl-shm-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd < 0) {
+    throw std::runtime_error(
+        fmt::format("memfd_create failed: {}", strerror(errno)));
+  }
+  size_t map_size = sizeof(Header) + capacity;
+  if (ftruncate(fd, static_cast<off_t>(map_size)) != 0 ||
+      fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+    int err = errno;
+    close(fd);
+    throw std::runtime_error(
+        fmt::format("Failed to size shared ring memfd: {}", strerror(err)));
+  }
+  ShmRing ring{fd, map_size};
+  ring.hdr->magic = MAGIC;
+  ring.hdr->capacity = capacity;
+  ring.hdr->head.store(0, std::memory_order_relaxed);
+  ring.hdr->tail.store(0, std::memory_order_release);
+  spdlog::debug("Created shared ring fd {} with capacity {}", fd, capacity);
+  return ring;
+}
+
+ShmRing ShmRing::attach(pid_t pid, int fd) {
+  // netlink can't carry SCM_RIGHTS, so duplicate the producer's memfd out of
+  // its fd table; unlike reopening /proc/<pid>/fd/<fd> this never opens a
+  // path, so a bogus fd number can't trigger side effects of open()
+  int pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+  if (pidfd < 0) {
+    throw std::runtime_error(
+        fmt::format("pidfd_open({}) failed: {}", pid, strerror(errno)));
+  }
+  int local_fd = static_cast<int>(syscall(SYS_pidfd_getfd, pidfd, fd, 0));
+  int err = errno;
+  if (local_fd < 0) {
+    close(pidfd);
+    throw std::runtime_error(fmt::format(
+        "Failed to get fd {} of process {}: {}", fd, pid, strerror(err)));
+  }
+  // only a sealed memfd can't be shrunk under our mapping, which would
+  // SIGBUS us
+  int seals = fcntl(local_fd, F_GET_SEALS);
+  struct stat st = {};
+  if (fstat(local_fd, &st) != 0 || !S_ISREG(st.st_mode) || seals < 0 ||
+      (seals & F_SEAL_SHRINK) == 0 ||
+      static_cast<size_t>(st.st_size) <= sizeof(Header)) {
+    close(local_fd);
+    close(pidfd);
+    throw std::runtime_error(fmt::format(
+        "fd {} of process {} is not a sealed shared ring", fd, pid));
+  }
+  ShmRing ring = [&] {
+    try {
+      return ShmRing{local_fd, static_cast<size_t>(st.st_size)};
+    } catch (std::runtime_error &) {
+      close(pidfd);
+      throw;
+    }
+  }();
+  // kept to notice when the producer exits
+  ring.owner_pidfd = pidfd;
+  if (ring.hdr->magic != MAGIC || ring.hdr->capacity != ring.cap) {
+    throw std::runtime_error(fmt::format(
+        "fd {} of process {} has an invalid shared ring header", fd, pid));
+  }
+  spdlog::debug("Attached shared ring fd {} of process {} with capacity {}",
+                fd, pid, ring.capacity());
+  return ring;
+}
+
+ShmRing::ShmRing(ShmRing &&other) noexcept
+    : memfd(std::exchange(other.memfd, -1)),
+      owner_pidfd(std::exchange(other.owner_pidfd, -1)),
+      map_size(std::exchange(other.map_size, 0)),
+      cap(std::exchange(other.cap, 0)), hdr(std::exchange(other.hdr, nullptr)),
+      data(std::exchange(other.data, nullptr)) {}
+
+ShmRing &ShmRing::operator=(ShmRing &&other) noexcept {
+  if (this != &other) {
+    _unmap();
+    memfd = std::exchange(other.memfd, -1);
+    owner_pidfd = std::exchange(other.owner_pidfd, -1);
+    map_size = std::exchange(other.map_size, 0);
+    cap = std::exchange(other.cap, 0);
+    hdr = std::exchange(other.hdr, nullptr);
+    data = std::exchange(other.data, nullptr);
+  }
+  return *this;
+}
+
+ShmRing::~ShmRing() { _unmap(); }
+
+void ShmRing::_unmap() {
+  if (hdr != nullptr) {
+    munmap(hdr, map_size);
+    hdr = nullptr;
+    data = nullptr;
+  }
+  if (memfd >= 0) {
+    close(memfd);
+    memfd = -1;
+  }
+  if (owner_pidfd >= 0) {
+    close(owner_pidfd);
+    owner_pidfd = -1;
+  }
+}
+
+bool ShmRing::owner_alive() const {
+  if (owner_pidfd < 0) {
+    return true;
+  }
+  // a pidfd becomes readable once its process has exited
+  struct pollfd pfd = {.fd = owner_pidfd, .events = POLLIN, .revents = 0};
+  return poll(&pfd, 1, 0) <= 0;
+}
+
+std::optional<ShmDescriptor> ShmRing::write(const void *payload, u32 length) {
+  if (length > cap) {
+    return std::nullopt;
+  }
+  u64 head = hdr->head.load(std::memory_order_relaxed);
+  u64 offset = head % cap;
+  if (offset + length > cap) {
+    // doesn't fit before the end, skip the remainder of this lap
+    head += cap - offset;
+    offset = 0;
+  }
+  u64 tail = hdr->tail.load(std::memory_order_acquire);
+  if (head + length - tail > cap) {
+    return std::nullopt;
+  }
+  memcpy(data + offset, payload, length);
+  hdr->head.store(head + length, std::memory_order_release);
+  return ShmDescriptor{.position = head, .length = length, .reserved = 0};
+}
+
+const u8 *ShmRing::read(const ShmDescriptor &desc) const {
+  u64 offset = desc.position % cap;
+  if (desc.length > cap - offset) {
+    throw std::invalid_argument(
+        fmt::format("shared ring descriptor out of bounds: offset {} len {}",
+                    offset, desc.length));
+  }
+  // head is written by the peer, tail only by us: a head behind the tail or
+  // more than a lap ahead of it can't come from a well-behaved producer
+  u64 head = hdr->head.load(std::memory_order_acquire);
+  u64 tail = hdr->tail.load(std::memory_order_relaxed);
+  if (head < tail || head - tail > cap) {
+    throw std::invalid_argument(fmt::format(
+        "corrupted shared ring indices: head {} tail {}", head, tail));
+  }
+  if (desc.position < tail || desc.position > head ||
+      desc.length > head - desc.position) {
+    throw std::invalid_argument(fmt::format(
+        "stale shared ring descriptor: position {} head {} tail {}",
+        desc.position, head, tail));
+  }
+  return data + offset;
+}
+
+void ShmRing::release(const ShmDescriptor &desc) {
+  // never move the tail past what the producer has published
+  u64 head = hdr->head.load(std::memory_order_acquire);
+  u64 end = desc.position > head ? head
+                                 : std::min(desc.position + desc.length, head);
+  if (end > hdr->tail.load(std::memory_order_relaxed)) {
+    hdr->tail.store(end, std::memory_order_release);
+  }
+}
+
+} // namespace nl
@@ -1,8 +1,17 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <libnl++/socket.hpp>
+#include <libnl++/trace.hpp>
 #include <netlink/errno.h>
+#include <mutex>
 #include <netlink/socket.h>
+#include <shared_mutex>
 #include <spdlog/spdlog.h>
 #include <stdexcept>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <unordered_map>
 
 namespace nl {
 
@@ -12,43 +21,309 @@ void NlSockDeleter::operator()(struct nl_sock *nlsock) const {
   }
 }
 
-nlsock_unique_ptr Socket::_create_nl_socket(int protocol, u32 port) {
+namespace {
+
+// transports by the libnl socket they receive for, libnl's recv override
+// gets nothing but the nl_sock to find them
+std::shared_mutex rx_transports_mutex;
+std::unordered_map<const struct nl_sock *, Transport *> rx_transports;
+
+Transport *find_rx_transport(const struct nl_sock *sk) {
+  std::shared_lock<std::shared_mutex> lock{rx_transports_mutex};
+  auto it = rx_transports.find(sk);
+  return it != rx_transports.end() ? it->second : nullptr;
+}
+
+} // namespace
+
+nlsock_unique_ptr Socket::_create_nl_socket() {
   struct nl_sock *sock_raw = nl_socket_alloc();
   if (sock_raw == NULL) {
     throw std::runtime_error("Failed to create NL socket");
   }
-  nl_socket_set_local_port(sock_raw, port);
-  if (nl_connect(sock_raw, protocol) != 0) {
-    nl_socket_free(sock_raw);
-    throw std::runtime_error("nl_connect failed");
-  }
+  // peek at the datagram size first, so that datagrams carrying several
+  // messages are never truncated
+  nl_socket_enable_msg_peek(sock_raw);
   nlsock_unique_ptr nlsock{sock_raw};
   return nlsock;
 }
 
+Socket::Socket(std::unique_ptr<Transport> transport, int nl_protocol, u32 port)
+    : nl_protocol(nl_protocol), nlsock(_create_nl_socket()),
+      transport(std::move(transport)) {
+  this->transport->attach(nlsock.get(), nl_protocol, port);
+  _set_default_callbacks();
+  std::unique_lock<std::shared_mutex> lock{rx_transports_mutex};
+  rx_transports[nlsock.get()] = this->transport.get();
+}
+
 void Socket::_send_msg_auto(Message &nlmsg) {
-  int ret = nl_send_auto_complete(nlsock.get(), nlmsg.get());
+  nl_complete_msg(nlsock.get(), nlmsg.get());
+  struct nlmsghdr *hdr = nlmsg_hdr(nlmsg.get());
+  int ret = transport->send(hdr, hdr->nlmsg_len);
   if (ret < 0) {
     throw std::runtime_error(fmt::format(
         "Sending netlink message failed, ret={} ({})", ret, nl_geterror(ret)));
   }
+  _tap_tx(hdr, hdr->nlmsg_len);
+}
+
+void Socket::_tap_tx(const void *data, size_t len) {
+  if (capture) {
+    capture->write(CaptureDirection::TX, nl_protocol, data, len);
+  }
+  trace::record(CaptureDirection::TX, nl_socket_get_peer_port(nlsock.get()),
+                data, len);
+}
+
+bool Socket::try_send_msg(Message &nlmsg) {
+  flush();
+  nl_complete_msg(nlsock.get(), nlmsg.get());
+  struct nlmsghdr *hdr = nlmsg_hdr(nlmsg.get());
+  return send_raw(hdr, hdr->nlmsg_len);
+}
+
+bool Socket::send_raw(const void *buf, size_t len) {
+  int ret = transport->send(buf, len);
+  if (ret == -NLE_AGAIN) {
+    return false;
+  }
+  if (ret < 0) {
+    throw std::runtime_error(fmt::format(
+        "Sending netlink message failed, ret={} ({})", ret, nl_geterror(ret)));
+  }
+  _tap_tx(buf, len);
+  return true;
+}
+
+Socket::~Socket() {
+  {
+    std::unique_lock<std::shared_mutex> lock{rx_transports_mutex};
+    rx_transports.erase(nlsock.get());
+  }
+  // flush() clears the queue even if sending fails
+  size_t pending = tx_coalescing.pending_msgs;
+  try {
+    flush();
+  } catch (std::runtime_error &e) {
+    spdlog::error("Dropped {} pending messages: {}", pending, e.what());
+  }
+  if (tx_coalescing.timer_fd >= 0) {
+    close(tx_coalescing.timer_fd);
+  }
+}
+
+void Socket::_send_msg_coalesced(Message &nlmsg) {
+  nl_complete_msg(nlsock.get(), nlmsg.get());
+  struct nlmsghdr *hdr = nlmsg_hdr(nlmsg.get());
+  size_t len = NLMSG_ALIGN(hdr->nlmsg_len);
+  auto &txq = tx_coalescing;
+  if (!txq.pending.empty() && txq.pending.size() + len > txq.max_bytes) {
+    flush();
+  }
+  if (txq.pending.empty()) {
+    txq.oldest_pending = std::chrono::steady_clock::now();
+    if (txq.timer_watched) {
+      _arm_flush_timer(txq.max_delay);
+    }
+  }
+  const u8 *msg_bytes = reinterpret_cast<const u8 *>(hdr);
+  txq.pending.insert(txq.pending.end(), msg_bytes, msg_bytes + hdr->nlmsg_len);
+  // keep the next message aligned
+  txq.pending.resize(txq.pending.size() + (len - hdr->nlmsg_len));
+  txq.pending_msgs++;
+  if (txq.pending.size() >= txq.max_bytes) {
+    flush();
+  } else {
+    flush_if_due();
+  }
+}
+
+void Socket::_arm_flush_timer(std::chrono::microseconds delay) {
+  // a zero it_value would disarm the timer, fire as soon as possible instead
+  auto usec = std::max<i64>(delay.count(), 1);
+  struct itimerspec spec = {};
+  spec.it_value.tv_sec = usec / 1000000;
+  spec.it_value.tv_nsec = (usec % 1000000) * 1000;
+  // also resets expirations left over from the previous datagram
+  if (timerfd_settime(tx_coalescing.timer_fd, 0, &spec, nullptr) != 0) {
+    throw std::runtime_error(
+        fmt::format("timerfd_settime failed: {}", strerror(errno)));
+  }
+  tx_coalescing.timer_armed = true;
+}
+
+void Socket::_disarm_flush_timer() {
+  if (!tx_coalescing.timer_armed) {
+    return;
+  }
+  // also drops an expiration that hasn't been consumed yet
+  struct itimerspec spec = {};
+  if (timerfd_settime(tx_coalescing.timer_fd, 0, &spec, nullptr) != 0) {
+    throw std::runtime_error(
+        fmt::format("timerfd_settime failed: {}", strerror(errno)));
+  }
+  tx_coalescing.timer_armed = false;
+}
+
+void Socket::watch_flush_timer(bool watched) {
+  auto &txq = tx_coalescing;
+  if (txq.timer_fd < 0) {
+    return;
+  }
+  txq.timer_watched = watched;
+  if (!watched) {
+    _disarm_flush_timer();
+  } else if (!txq.pending.empty()) {
+    auto waited = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - txq.oldest_pending);
+    _arm_flush_timer(txq.max_delay - waited);
+  }
+}
+
+void Socket::handle_flush_timer() {
+  auto &txq = tx_coalescing;
+  u64 expirations = 0;
+  if (read(txq.timer_fd, &expirations, sizeof(expirations)) < 0) {
+    // spurious wakeup, the timer hasn't actually expired
+    return;
+  }
+  txq.timer_armed = false;
+  if (!flush_if_due() && !txq.pending.empty()) {
+    auto waited = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - txq.oldest_pending);
+    _arm_flush_timer(txq.max_delay - waited);
+  }
+}
+
+void Socket::enable_coalescing(size_t max_bytes,
+                               std::chrono::microseconds max_delay) {
+  flush();
+  if (tx_coalescing.timer_fd < 0) {
+    tx_coalescing.timer_fd =
+        timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (tx_coalescing.timer_fd < 0) {
+      throw std::runtime_error(
+          fmt::format("timerfd_create failed: {}", strerror(errno)));
+    }
+  }
+  tx_coalescing.enabled = true;
+  tx_coalescing.max_bytes = max_bytes;
+  tx_coalescing.max_delay = max_delay;
+  tx_coalescing.pending.reserve(max_bytes);
+}
+
+void Socket::disable_coalescing() {
+  flush();
+  tx_coalescing.enabled = false;
+}
+
+void Socket::flush() {
+  auto &txq = tx_coalescing;
+  if (txq.pending.empty()) {
+    return;
+  }
+  _disarm_flush_timer();
+  int ret = transport->send(txq.pending.data(), txq.pending.size());
+  spdlog::debug("Flushed {} coalesced messages, {} bytes", txq.pending_msgs,
+                txq.pending.size());
+  if (ret >= 0) {
+    _tap_tx(txq.pending.data(), txq.pending.size());
+  }
+  txq.pending.clear();
+  txq.pending_msgs = 0;
+  if (ret < 0) {
+    throw std::runtime_error(fmt::format(
+        "Sending netlink message failed, ret={} ({})", ret, nl_geterror(ret)));
+  }
+}
+
+bool Socket::flush_if_due() {
+  auto &txq = tx_coalescing;
+  if (txq.pending.empty() ||
+      std::chrono::steady_clock::now() - txq.oldest_pending < txq.max_delay) {
+    return false;
+  }
+  flush();
+  return true;
+}
+
+void Socket::set_auto_ack(bool enable) {
+  if (enable) {
+    nl_socket_enable_auto_ack(nlsock.get());
+  } else {
+    nl_socket_disable_auto_ack(nlsock.get());
+  }
+}
+
+void Socket::set_passcred(bool enable) {
+  int ret = transport->set_passcred(enable);
+  if (ret < 0) {
+    throw std::runtime_error(fmt::format(
+        "Failed to set credential passing: {}", nl_geterror(ret)));
+  }
+}
+
+void Socket::set_buffer_size(int rxbuf, int txbuf) {
+  int ret = transport->set_buffer_size(rxbuf, txbuf);
+  if (ret < 0) {
+    throw std::runtime_error(fmt::format("Failed to set socket buffer size: {}",
+                                         nl_geterror(ret)));
+  }
 }
 
 void Socket::_add_membership(int multicast_group_id) {
-  int ret = nl_socket_add_membership(nlsock.get(), multicast_group_id);
+  int ret = transport->add_membership(multicast_group_id);
   if (ret < 0) {
     throw std::runtime_error(fmt::format(
-        "Failed to add multicast membership {}: {}", ret, strerror(-ret)));
+        "Failed to add multicast membership {}: {}", ret, nl_geterror(ret)));
   }
 }
 void Socket::_set_local_port(const u32 port) {
-  nl_socket_set_local_port(nlsock.get(), port);
+  transport->set_local_port(port);
 }
 
 void Socket::_set_peer_port(u32 port) {
+  // pending messages are addressed to the current peer
+  if (tx_coalescing.enabled && nl_socket_get_peer_port(nlsock.get()) != port) {
+    flush();
+  }
   nl_socket_set_peer_port(nlsock.get(), port);
 }
 
+void Socket::recv_msg(
+    const std::pair<NetlinkValidCallback, void *> &cb_ctx_pair) {
+  flush();
+  recv_ctx.valid_cb_ctx_pair = cb_ctx_pair;
+  recv_ctx.nl_recv_status = RecvStatus::CONTINUE;
+  while (recv_ctx.nl_recv_status == RecvStatus::CONTINUE) {
+    spdlog::debug("starting recv()");
+    int res = nl_recvmsgs(nlsock.get(), nlcbs.get());
+    if (res != 0) {
+      spdlog::error("nl_recvmsgs() failed with code {} ({})", res,
+                    nl_geterror(res));
+      // nl_recv_status is updated in the callback itself
+    }
+  }
+}
+
+int Socket::recv_pending(int budget) {
+  flush();
+  int processed = 0;
+  while (processed < budget) {
+    int res = nl_recvmsgs_report(nlsock.get(), nlcbs.get());
+    if (res == -NLE_AGAIN) {
+      break;
+    }
+    if (res < 0) {
+      spdlog::error("nl_recvmsgs() failed with code {} ({})", res,
+                    nl_geterror(res));
+    }
+    processed++;
+  }
+  return processed;
+}
+
 void Socket::_set_default_callbacks() {
   spdlog::debug("Start registering default callbacks");
   nlcbs.register_cb(NL_CB_SEQ_CHECK, RxCallbacks::default_seq_disable, NULL);
@@ -56,6 +331,8 @@ void Socket::_set_default_callbacks() {
   nlcbs.register_cb(NL_CB_ACK, RxCallbacks::default_ack_handler, this);
   nlcbs.register_err_cb(RxCallbacks::default_error_handler, this);
   nlcbs.register_cb(NL_CB_VALID, RxCallbacks::response_handler_wrapper, this);
+  nlcbs.register_cb(NL_CB_MSG_IN, RxCallbacks::capture_handler, this);
+  nl_cb_overwrite_recv(nlcbs.get(), RxCallbacks::transport_recv);
   nl_socket_set_cb(nlsock.get(), nlcbs.get());
   spdlog::debug("Register default callbacks ok");
 }
@@ -94,6 +371,31 @@ int Socket::RxCallbacks::default_error_handler(struct sockaddr_nl *nla,
   return NL_SKIP;
 }
 
+int Socket::RxCallbacks::capture_handler(struct nl_msg *msg, void *arg) {
+  Socket *const nlsock = static_cast<Socket *>(arg);
+  struct nlmsghdr *hdr = nlmsg_hdr(msg);
+  if (nlsock->capture) {
+    nlsock->capture->write(CaptureDirection::RX, nlsock->nl_protocol, hdr,
+                           hdr->nlmsg_len);
+  }
+  trace::record(CaptureDirection::RX, nlmsg_get_src(msg)->nl_pid, hdr,
+                hdr->nlmsg_len);
+  return NL_OK;
+}
+
+int Socket::RxCallbacks::transport_recv(struct nl_sock *sk,
+                                        struct sockaddr_nl *nla,
+                                        unsigned char **buf,
+                                        struct ucred **creds) {
+  // libnl also receives through our callbacks on its own, e.g. when
+  // resolving a genl family; sockets without a transport are read directly
+  Transport *transport = find_rx_transport(sk);
+  if (transport == nullptr) {
+    return nl_recv(sk, nla, buf, creds);
+  }
+  return transport->recv(nla, buf, creds);
+}
+
 int Socket::RxCallbacks::default_seq_disable(struct nl_msg *msg, void *arg) {
   return NL_OK;
 }
@@ -108,6 +410,10 @@ int Socket::RxCallbacks::response_handler_wrapper(struct nl_msg *msg,
 
   NetlinkValidCallback valid_cb = nlsock->recv_ctx.valid_cb_ctx_pair.first;
   void *valid_cb_ctx = nlsock->recv_ctx.valid_cb_ctx_pair.second;
+  if (valid_cb == nullptr) {
+    spdlog::debug("No response handler set, skipping message");
+    return NL_SKIP;
+  }
 
   spdlog::debug("Starting handler callback...");
   nl_cb_action parse_res = valid_cb(msg, valid_cb_ctx);
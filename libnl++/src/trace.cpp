@@ -0,0 +1,269 @@
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <libnl++/trace.hpp>
+#include <libnl++/util.hpp>
+#include <new>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace nl {
+namespace trace {
+
+std::atomic<bool> enabled{false};
+
+namespace {
+
+struct SlotData {
+  u64 timestamp_ns;
+  u32 len;
+  u32 port;
+  u16 captured;
+  CaptureDirection dir;
+  u8 data[SNAPLEN];
+};
+
+struct Slot {
+  // odd while being written, 2 * (record index + 1) once complete
+  std::atomic<u64> seq{0};
+  SlotData rec;
+};
+
+struct Ring {
+  std::atomic<bool> in_use{false};
+  std::atomic<pid_t> tid{0};
+  std::atomic<u64> head{0}; // records written so far
+  Slot slots[RING_SLOTS];
+};
+
+// rings are never freed, so dump() can't race with a thread exiting
+std::atomic<Ring *> rings[MAX_RINGS];
+
+Ring *claim_ring() {
+  // keep the records of exited threads while there is room for new rings
+  bool have_free_entry = false;
+  for (auto &entry : rings) {
+    if (entry.load(std::memory_order_acquire) == nullptr) {
+      have_free_entry = true;
+      break;
+    }
+  }
+  if (have_free_entry) {
+    Ring *ring = new (std::nothrow) Ring;
+    if (ring != nullptr) {
+      ring->in_use.store(true, std::memory_order_relaxed);
+      for (auto &entry : rings) {
+        Ring *expected = nullptr;
+        if (entry.compare_exchange_strong(expected, ring,
+                                          std::memory_order_acq_rel)) {
+          return ring;
+        }
+      }
+      // other threads took the last entries meanwhile
+      delete ring;
+    }
+  }
+  // all entries are taken, fall back to a ring left behind by an exited
+  // thread
+  for (auto &entry : rings) {
+    Ring *ring = entry.load(std::memory_order_acquire);
+    bool expected = false;
+    if (ring != nullptr &&
+        ring->in_use.compare_exchange_strong(expected, true)) {
+      return ring;
+    }
+  }
+  return nullptr;
+}
+
+class ThreadRing {
+  Ring *ring = nullptr;
+  bool claimed = false;
+
+public:
+  ~ThreadRing() {
+    if (ring != nullptr) {
+      ring->in_use.store(false, std::memory_order_release);
+    }
+  }
+
+  Ring *get() {
+    if (!claimed) {
+      claimed = true;
+      ring = claim_ring();
+      if (ring != nullptr) {
+        ring->tid.store(static_cast<pid_t>(syscall(SYS_gettid)),
+                        std::memory_order_relaxed);
+      }
+    }
+    return ring;
+  }
+};
+
+thread_local ThreadRing thread_ring;
+
+/*
+ * Read a complete slot, returns false if it was overwritten meanwhile
+ */
+bool read_slot(const Slot &slot, u64 index, SlotData &out) {
+  u64 seq = slot.seq.load(std::memory_order_acquire);
+  if (seq != 2 * (index + 1)) {
+    return false;
+  }
+  memcpy(&out, &slot.rec, sizeof(out));
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot.seq.load(std::memory_order_relaxed) == seq;
+}
+
+// formatting helpers usable from signal handlers
+
+char *append_str(char *out, const char *str) {
+  while (*str != '\0') {
+    *out++ = *str++;
+  }
+  return out;
+}
+
+char *append_u64(char *out, u64 value, int min_width = 0) {
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  while (n < min_width) {
+    digits[n++] = '0';
+  }
+  while (n > 0) {
+    *out++ = digits[--n];
+  }
+  return out;
+}
+
+void write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    buf += n;
+    len -= static_cast<size_t>(n);
+  }
+}
+
+void crash_handler(int signum) {
+  const char msg[] = "Fatal signal, dumping netlink trace\n";
+  write_all(STDERR_FILENO, msg, sizeof(msg) - 1);
+  dump(STDERR_FILENO);
+  // SA_RESETHAND restored the default action
+  raise(signum);
+}
+
+void dump_handler(int signum) {
+  int saved_errno = errno;
+  dump(STDERR_FILENO);
+  errno = saved_errno;
+}
+
+void install_handler(int signum, void (*handler)(int), int flags) {
+  struct sigaction sa = {};
+  sa.sa_handler = handler;
+  sa.sa_flags = flags;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(signum, &sa, nullptr) != 0) {
+    throw std::runtime_error(
+        fmt::format("sigaction({}) failed: {}", signum, strerror(errno)));
+  }
+}
+
+} // namespace
+
+void record_slow(CaptureDirection dir, u32 port, const void *data,
+                 size_t len) {
+  Ring *ring = thread_ring.get();
+  if (ring == nullptr) {
+    return;
+  }
+  u64 index = ring->head.load(std::memory_order_relaxed);
+  Slot &slot = ring->slots[index % RING_SLOTS];
+  slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  size_t captured = len < SNAPLEN ? len : SNAPLEN;
+  slot.rec.timestamp_ns = static_cast<u64>(ts.tv_sec) * 1000000000ULL +
+                          static_cast<u64>(ts.tv_nsec);
+  slot.rec.len = static_cast<u32>(len);
+  slot.rec.port = port;
+  slot.rec.captured = static_cast<u16>(captured);
+  slot.rec.dir = dir;
+  memcpy(slot.rec.data, data, captured);
+
+  slot.seq.store(2 * (index + 1), std::memory_order_release);
+  ring->head.store(index + 1, std::memory_order_release);
+}
+
+void dump(int fd) {
+  char line[128];
+  char hex[2048];
+  SlotData rec;
+  for (auto &entry : rings) {
+    Ring *ring = entry.load(std::memory_order_acquire);
+    if (ring == nullptr) {
+      continue;
+    }
+    u64 head = ring->head.load(std::memory_order_acquire);
+    u64 start = head > RING_SLOTS ? head - RING_SLOTS : 0;
+
+    char *cur = append_str(line, "--- netlink trace of thread ");
+    cur = append_u64(cur, static_cast<u64>(ring->tid.load()));
+    cur = append_str(cur, ring->in_use.load() ? "" : " (exited)");
+    cur = append_str(cur, ", records ");
+    cur = append_u64(cur, start);
+    cur = append_str(cur, "..");
+    cur = append_u64(cur, head);
+    cur = append_str(cur, " ---\n");
+    write_all(fd, line, static_cast<size_t>(cur - line));
+
+    for (u64 i = start; i < head; i++) {
+      if (!read_slot(ring->slots[i % RING_SLOTS], i, rec)) {
+        continue;
+      }
+      cur = append_str(line, "#");
+      cur = append_u64(cur, i);
+      cur = append_str(cur, " ");
+      cur = append_u64(cur, rec.timestamp_ns / 1000000000ULL);
+      cur = append_str(cur, ".");
+      cur = append_u64(cur, rec.timestamp_ns % 1000000000ULL, 9);
+      cur = append_str(cur, rec.dir == CaptureDirection::TX ? " tx" : " rx");
+      cur = append_str(cur, " port ");
+      cur = append_u64(cur, rec.port);
+      cur = append_str(cur, " len ");
+      cur = append_u64(cur, rec.len);
+      cur = append_str(cur, "\n");
+      write_all(fd, line, static_cast<size_t>(cur - line));
+      size_t n = format_hexdump(hex, sizeof(hex), rec.data, rec.captured);
+      write_all(fd, hex, n);
+    }
+  }
+}
+
+void install_crash_handler() {
+  for (int signum : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) {
+    install_handler(signum, crash_handler, SA_RESETHAND | SA_NODEFER);
+  }
+}
+
+void install_dump_signal(int signum) {
+  install_handler(signum, dump_handler, SA_RESTART);
+}
+
+} // namespace trace
+} // namespace nl
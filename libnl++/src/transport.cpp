@@ -0,0 +1,66 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <libnl++/transport.hpp>
+#include <netlink/socket.h>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+namespace nl {
+
+void KernelTransport::attach(struct nl_sock *sk, int nl_protocol, u32 port) {
+  nlsock = sk;
+  nl_socket_set_local_port(nlsock, port);
+  int ret = nl_connect(nlsock, nl_protocol);
+  if (ret != 0) {
+    throw std::runtime_error(
+        fmt::format("nl_connect failed: {}", nl_geterror(ret)));
+  }
+}
+
+int KernelTransport::fd() const { return nl_socket_get_fd(nlsock); }
+
+void KernelTransport::set_nonblocking(bool nonblocking) {
+  int flags = fcntl(fd(), F_GETFL, 0);
+  if (flags < 0) {
+    throw std::runtime_error(
+        fmt::format("fcntl(F_GETFL) failed: {}", strerror(errno)));
+  }
+  flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+  if (fcntl(fd(), F_SETFL, flags) < 0) {
+    throw std::runtime_error(
+        fmt::format("fcntl(F_SETFL) failed: {}", strerror(errno)));
+  }
+}
+
+bool KernelTransport::is_nonblocking() const {
+  int flags = fcntl(fd(), F_GETFL, 0);
+  return flags >= 0 && (flags & O_NONBLOCK) != 0;
+}
+
+void KernelTransport::set_local_port(u32 port) {
+  nl_socket_set_local_port(nlsock, port);
+}
+
+int KernelTransport::add_membership(int multicast_group_id) {
+  return nl_socket_add_membership(nlsock, multicast_group_id);
+}
+
+int KernelTransport::set_passcred(bool enable) {
+  return nl_socket_set_passcred(nlsock, enable ? 1 : 0);
+}
+
+int KernelTransport::set_buffer_size(int rxbuf, int txbuf) {
+  return nl_socket_set_buffer_size(nlsock, rxbuf, txbuf);
+}
+
+int KernelTransport::send(const void *buf, size_t len) {
+  return nl_sendto(nlsock, const_cast<void *>(buf), len);
+}
+
+int KernelTransport::recv(struct sockaddr_nl *src, unsigned char **buf,
+                          struct ucred **creds) {
+  return nl_recv(nlsock, src, buf, creds);
+}
+
+} // namespace nl
@@ -1,43 +1,158 @@
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
-#include <iomanip>
 #include <iostream>
 #include <libnl++/util.hpp>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-void hexdump(const void *data, size_t length, size_t bytes_per_line) {
-  const uint8_t *ptr = static_cast<const uint8_t *>(data);
+namespace nl {
+
+namespace {
+
+constexpr char HEX_DIGITS[] = "0123456789abcdef";
+
+// "oooooooo  xx xx ... xx  xx ... xx  aaaa...\n"
+std::size_t line_len(std::size_t bytes_per_line) {
+  return 8 + 2 + bytes_per_line * 3 + (bytes_per_line > 7 ? 1 : 0) + 1 +
+         bytes_per_line + 1;
+}
+
+char *format_offset(char *out, std::size_t offset) {
+  for (int shift = 28; shift >= 0; shift -= 4) {
+    *out++ = HEX_DIGITS[(offset >> shift) & 0xf];
+  }
+  *out++ = ' ';
+  *out++ = ' ';
+  return out;
+}
 
-  for (size_t i = 0; i < length; i += bytes_per_line) {
-    // print offset
-    std::cout << std::setw(8) << std::setfill('0') << std::hex << i << "  ";
-
-    // print hex values
-    for (size_t j = 0; j < bytes_per_line; ++j) {
-      if (i + j < length) {
-        std::cout << std::setw(2) << static_cast<int>(ptr[i + j]) << " ";
-      } else {
-        std::cout << "   ";
-      }
-      if (j == 7)
-        std::cout << " "; // extra space in middle
+char *format_line_scalar(char *out, const uint8_t *ptr, std::size_t n,
+                         std::size_t bytes_per_line) {
+  // print hex values
+  for (std::size_t j = 0; j < bytes_per_line; ++j) {
+    if (j < n) {
+      out[0] = HEX_DIGITS[ptr[j] >> 4];
+      out[1] = HEX_DIGITS[ptr[j] & 0xf];
+    } else {
+      out[0] = ' ';
+      out[1] = ' ';
     }
+    out[2] = ' ';
+    out += 3;
+    if (j == 7) {
+      *out++ = ' '; // extra space in middle
+    }
+  }
+  *out++ = ' ';
+  // print ascii representation
+  for (std::size_t j = 0; j < bytes_per_line; ++j) {
+    if (j < n) {
+      *out++ = (ptr[j] >= 0x20 && ptr[j] < 0x7f) ? static_cast<char>(ptr[j])
+                                                 : '.';
+    } else {
+      *out++ = ' ';
+    }
+  }
+  *out++ = '\n';
+  return out;
+}
+
+#if defined(__SSE2__)
+inline __m128i nibbles_to_hex(__m128i nibbles) {
+  __m128i above_9 = _mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9));
+  __m128i digits = _mm_add_epi8(nibbles, _mm_set1_epi8('0'));
+  return _mm_add_epi8(digits,
+                      _mm_and_si128(above_9, _mm_set1_epi8('a' - '0' - 10)));
+}
 
-    std::cout << " ";
-
-    // print ascii representation
-    for (size_t j = 0; j < bytes_per_line; ++j) {
-      if (i + j < length) {
-        char cur_char = static_cast<char>(ptr[i + j]);
-        std::cout << (std::isprint(static_cast<unsigned char>(cur_char)) != 0
-                          ? cur_char
-                          : '.');
-      } else {
-        std::cout << ' ';
-      }
+/*
+ * Full 16-byte line: nibble to hex conversion and printable classification
+ * are done for the whole line at once, only the placement is scalar.
+ */
+char *format_line_16(char *out, const uint8_t *ptr) {
+  const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr));
+  const __m128i low_mask = _mm_set1_epi8(0x0f);
+  const __m128i lo = _mm_and_si128(v, low_mask);
+  const __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low_mask);
+
+  alignas(16) char hex[32];
+  _mm_store_si128(reinterpret_cast<__m128i *>(hex),
+                  nibbles_to_hex(_mm_unpacklo_epi8(hi, lo)));
+  _mm_store_si128(reinterpret_cast<__m128i *>(hex + 16),
+                  nibbles_to_hex(_mm_unpackhi_epi8(hi, lo)));
+  for (int j = 0; j < 16; ++j) {
+    out[0] = hex[2 * j];
+    out[1] = hex[2 * j + 1];
+    out[2] = ' ';
+    out += 3;
+    if (j == 7) {
+      *out++ = ' ';
     }
+  }
+  *out++ = ' ';
+
+  // signed compares: bytes >= 0x80 are negative and fail the first one
+  const __m128i printable =
+      _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)),
+                    _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+  const __m128i ascii =
+      _mm_or_si128(_mm_and_si128(printable, v),
+                   _mm_andnot_si128(printable, _mm_set1_epi8('.')));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(out), ascii);
+  out += 16;
+  *out++ = '\n';
+  return out;
+}
+#endif
+
+} // namespace
+
+std::size_t hexdump_size(std::size_t length, std::size_t bytes_per_line) {
+  std::size_t lines = (length + bytes_per_line - 1) / bytes_per_line;
+  return lines * line_len(bytes_per_line);
+}
 
-    std::cout << "\n";
+std::size_t format_hexdump(char *out, std::size_t out_size, const void *data,
+                           std::size_t length, std::size_t bytes_per_line,
+                           std::size_t base_offset) {
+  const uint8_t *ptr = static_cast<const uint8_t *>(data);
+  const std::size_t len_per_line = line_len(bytes_per_line);
+  char *cur = out;
+  for (std::size_t i = 0; i < length; i += bytes_per_line) {
+    if (static_cast<std::size_t>(cur - out) + len_per_line > out_size) {
+      break;
+    }
+    std::size_t n = std::min(bytes_per_line, length - i);
+    cur = format_offset(cur, base_offset + i);
+#if defined(__SSE2__)
+    if (bytes_per_line == 16 && n == 16) {
+      cur = format_line_16(cur, ptr + i);
+      continue;
+    }
+#endif
+    cur = format_line_scalar(cur, ptr + i, n, bytes_per_line);
   }
+  return static_cast<std::size_t>(cur - out);
+}
 
-  std::cout << std::dec; // reset to decimal output
+void hexdump(const void *data, std::size_t length,
+             std::size_t bytes_per_line) {
+  const uint8_t *ptr = static_cast<const uint8_t *>(data);
+  // render a bounded number of lines at a time
+  const std::size_t lines_per_chunk =
+      std::max<std::size_t>(1, 8192 / line_len(bytes_per_line));
+  const std::size_t chunk_bytes = lines_per_chunk * bytes_per_line;
+  std::vector<char> buf(lines_per_chunk * line_len(bytes_per_line));
+  for (std::size_t i = 0; i < length; i += chunk_bytes) {
+    std::size_t n = format_hexdump(buf.data(), buf.size(), ptr + i,
+                                   std::min(chunk_bytes, length - i),
+                                   bytes_per_line, i);
+    std::cout.write(buf.data(), static_cast<std::streamsize>(n));
+  }
+  std::cout.flush();
 }
+
+} // namespace nl
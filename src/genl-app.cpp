@@ -1,42 +1,614 @@
 #include <CLI/CLI.hpp>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <chrono>
+#include <cstring>
+#include <latency.hpp>
+#include <libnl++/capture.hpp>
+#include <libnl++/dump.hpp>
 #include <libnl++/genl.hpp>
+#include <libnl++/loopback.hpp>
+#include <libnl++/reactor.hpp>
+#include <libnl++/shm.hpp>
 #include <libnl++/socket.hpp>
+#include <libnl++/trace.hpp>
 #include <netlink/attr.h>
+#include <optional>
+#include <pthread.h>
+#include <sched.h>
+#include <scheduler.hpp>
 #include <spdlog/spdlog.h>
+#include <string_view>
+#include <thread>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <unordered_map>
 
 using nl::u32;
+using nl::u64;
 namespace GenlApp {
 
-#define ATTR_MAX 2
+#define ATTR_MAX 6
 constexpr int CMD_SERVER_REQUEST = 0;
 constexpr int CMD_SERVER_RESPONSE = 1;
+constexpr int CMD_SHM_SETUP = 2;     // attach client's shared ring
+constexpr int CMD_SHM_TEARDOWN = 3;  // detach client's shared ring
+constexpr int CMD_DUMP_REQUEST = 4;  // dump the whole table
+constexpr int CMD_DUMP_RESPONSE = 5; // one part of a dump
 constexpr int ATTR_PAYLOAD = 0;
+constexpr int ATTR_SHM_PID = 1;     // u32, pid owning the ring, must be sender
+constexpr int ATTR_SHM_FD = 2;      // u32, memfd number in that process
+constexpr int ATTR_SHM_DESC = 3;    // nl::ShmDescriptor, payload in shared ring
+constexpr int ATTR_DUMP_CURSOR = 4; // u64, position to start/resume a dump at
+constexpr int ATTR_RECORD = 5;      // string, one table record
+constexpr int ATTR_PRIORITY = 6;    // u32, traffic class requested by client
 
-nl::callback_result_t parse_request(struct nl_msg *msg, void *ctx) {
-  spdlog::debug("Received netlink message");
+// attribute types and minimal lengths enforced when parsing requests
+const auto request_policy = [] {
+  std::array<struct nla_policy, ATTR_MAX + 1> policy{};
+  policy[ATTR_SHM_PID].type = NLA_U32;
+  policy[ATTR_SHM_FD].type = NLA_U32;
+  policy[ATTR_SHM_DESC].minlen = sizeof(nl::ShmDescriptor);
+  policy[ATTR_DUMP_CURSOR].type = NLA_U64;
+  policy[ATTR_RECORD].type = NLA_STRING;
+  policy[ATTR_PRIORITY].type = NLA_U32;
+  return policy;
+}();
+
+// big enough for any response we send, used to preallocate responses
+constexpr size_t MAX_RESPONSE_SIZE = 64 * 1024;
+// longest payload an attribute can carry: nla_len is 16 bits and covers the
+// attribute header and the terminating NUL
+constexpr size_t MAX_INLINE_PAYLOAD = 0xffff - NLA_HDRLEN - 1;
+// room for several messages with the longest inline payload, libnl's 32 KiB
+// default can't take a single one; the kernel caps it at net.core.*mem_max
+constexpr int SOCKET_BUFFER_SIZE = 1024 * 1024;
+// how long a payload too long to be inlined waits for room in the shared ring
+constexpr auto SHM_FULL_TIMEOUT = std::chrono::seconds(1);
+// how often the server looks for shared rings of clients that have exited
+constexpr auto SHM_REAP_INTERVAL = std::chrono::seconds(1);
+
+/*
+ * Size of a message carrying a single attribute of the given length.
+ */
+size_t msg_size_for_attr(size_t attr_len) {
+  return nlmsg_total_size(GENL_HDRLEN + nla_total_size((int)attr_len));
+}
+
+struct ServerOptions {
+  bool low_latency = false;
+  int cpu = -1; // core to pin the receive/handler thread to, -1 to not pin
+  u64 table_size = 100000; // records served by dumps
+  std::string capture_path; // record traffic to this pcap file if not empty
+  // relative share of each traffic class, requests are handled in arrival
+  // order if empty
+  std::vector<u32> class_weights;
+  std::unordered_map<u32, u32> port_classes; // traffic class by sender port
+  size_t queue_depth = 1024; // max requests waiting per class
+  int stats_interval = 10;   // seconds between per-class reports
+};
+
+struct ServerContext;
+
+/*
+ * A received request waiting for its handler.
+ */
+struct QueuedRequest {
+  nl::nlmsg_unique_ptr msg;
+  ServerContext *server_ctx;
+};
+
+// credit per unit of class weight and scheduling turn, in bytes
+constexpr size_t CLASS_QUANTUM = 4096;
+// requests handled between two polls of the sockets
+constexpr int HANDLE_BATCH = 32;
+
+/*
+ * Requests of all server sockets, queued by traffic class.
+ */
+struct RequestScheduler {
+  struct PortBacklog {
+    size_t cls = 0;
+    size_t queued = 0;
+  };
+
+  FairQueue<QueuedRequest> queue;
+  std::unordered_map<u32, u32> port_classes;
+  // class and number of queued requests of ports that have any queued
+  std::unordered_map<u32, PortBacklog> backlogs;
+
+  explicit RequestScheduler(const ServerOptions &opts)
+      : queue{opts.class_weights, opts.queue_depth, CLASS_QUANTUM},
+        port_classes{opts.port_classes} {
+    for (const auto &[port, cls] : port_classes) {
+      if (cls >= queue.num_classes()) {
+        throw std::runtime_error(
+            fmt::format("port {} is assigned class {}, but there are only {} "
+                        "classes",
+                        port, cls, queue.num_classes()));
+      }
+    }
+  }
+
+  /*
+   * Class of a port's queued requests, else the one requested by the
+   * client, else the one configured for its port, else class 0. Requests
+   * are classified before their attributes are validated, so a malformed or
+   * unknown priority gets class 0 too.
+   */
+  size_t classify(struct nl_msg *msg, u32 peer_port) const {
+    // requests are handled in order within a class only, so a port's
+    // requests stay in one class while any are queued; e.g. a ring teardown
+    // (which has no priority) mustn't overtake requests using the ring
+    if (auto it = backlogs.find(peer_port); it != backlogs.end()) {
+      return it->second.cls;
+    }
+    struct genlmsghdr *genl_header = (genlmsghdr *)nlmsg_data(nlmsg_hdr(msg));
+    struct nlattr *priority_attr =
+        nla_find(genlmsg_attrdata(genl_header, 0),
+                 genlmsg_attrlen(genl_header, 0), ATTR_PRIORITY);
+    u32 cls = 0;
+    if (priority_attr != nullptr) {
+      if (nla_len(priority_attr) != sizeof(u32)) {
+        return 0;
+      }
+      cls = nla_get_u32(priority_attr);
+    } else if (auto it = port_classes.find(peer_port);
+               it != port_classes.end()) {
+      cls = it->second;
+    }
+    return cls < queue.num_classes() ? cls : 0;
+  }
+
+  /*
+   * Queue a request, takes a reference on msg if it is queued.
+   * @return class of the request and whether it was queued, false if the
+   * class queue is full
+   */
+  std::pair<size_t, bool> enqueue(struct nl_msg *msg, ServerContext *ctx) {
+    u32 peer_port = nlmsg_get_src(msg)->nl_pid;
+    size_t cls = classify(msg, peer_port);
+    nlmsg_get(msg);
+    if (!queue.push(cls, {nl::nlmsg_unique_ptr{msg}, ctx},
+                    nlmsg_hdr(msg)->nlmsg_len)) {
+      return {cls, false};
+    }
+    PortBacklog &backlog = backlogs[peer_port];
+    backlog.cls = cls;
+    backlog.queued++;
+    return {cls, true};
+  }
+
+  /*
+   * Account a request popped from the queue as handled.
+   */
+  void handled(const FairQueue<QueuedRequest>::Dequeued &request) {
+    queue.done(request);
+    u32 peer_port = nlmsg_get_src(request.item.msg.get())->nl_pid;
+    auto it = backlogs.find(peer_port);
+    if (it != backlogs.end() && --it->second.queued == 0) {
+      backlogs.erase(it);
+    }
+  }
+};
+
+// retry interval for dumps parked on a full client receive buffer, netlink
+// doesn't tell when the client has made room
+constexpr int DUMP_RETRY_MS = 1;
+// dumps whose client didn't read anything for this long are abandoned
+constexpr auto DUMP_STALL_TIMEOUT = std::chrono::seconds(30);
+
+/*
+ * A dump in progress. Records are generated on the fly, so nothing but the
+ * message being filled is kept per dump.
+ */
+struct DumpSession {
+  std::unique_ptr<nl::DumpWriter> writer;
+  u64 next = 0; // next record to put into the dump
+  std::chrono::steady_clock::time_point last_progress;
+};
+
+/*
+ * Per-socket server state passed to request handlers.
+ */
+struct ServerContext {
+  nl::Socket &sock;
+  // requests are queued here instead of being handled right away if set
+  RequestScheduler *scheduler = nullptr;
+  // in low-latency mode a single preallocated response is reused for every
+  // request instead of allocating a fresh one
+  std::optional<nl::Message> prealloc_response;
+  // shared rings attached by clients, by client port
+  std::unordered_map<u32, nl::ShmRing> shm_rings;
+  // unfinished dumps, by client port
+  std::unordered_map<u32, DumpSession> dumps;
+
+  u64 table_size;
+
+  ServerContext(nl::Socket &sock, const ServerOptions &opts)
+      : sock{sock}, table_size{opts.table_size} {
+    // shared ring setup needs the sender's pid
+    sock.set_passcred(true);
+    // requests and their echoes may carry payloads of up to 64 KiB
+    sock.set_buffer_size(SOCKET_BUFFER_SIZE, SOCKET_BUFFER_SIZE);
+    if (opts.low_latency) {
+      prealloc_response.emplace(MAX_RESPONSE_SIZE);
+    }
+  }
+};
+
+void send_response(ServerContext &server_ctx, u32 peer_port, u32 seq,
+                   const void *payload, int payload_len) {
+  std::optional<nl::Message> fresh_response;
+  nl::Message *response;
+  size_t response_size = msg_size_for_attr(payload_len);
+  if (server_ctx.prealloc_response && response_size <= MAX_RESPONSE_SIZE) {
+    response = &*server_ctx.prealloc_response;
+    response->reset();
+  } else {
+    response = &fresh_response.emplace(response_size);
+  }
+  response->put_header(GenlApp::CMD_SERVER_RESPONSE, NETLINK_GENERIC, 0, seq);
+  if (payload != nullptr) {
+    response->put_bytes(GenlApp::ATTR_PAYLOAD, payload, payload_len);
+  }
+  server_ctx.sock.set_peer_port(peer_port);
+  server_ctx.sock.send_msg(*response);
+}
+
+/*
+ * Report a failed request the way the kernel does: an NLMSG_ERROR quoting the
+ * request's header, which ends the client's recv_msg() through its error
+ * callback. Like responses, errors only go to clients that asked for an ack.
+ * @param error - negative errno
+ */
+void send_error(ServerContext &server_ctx, u32 peer_port,
+                const struct nlmsghdr *request, int error) {
+  if ((request->nlmsg_flags & NLM_F_ACK) == 0) {
+    return;
+  }
+  nl::Message msg{
+      static_cast<size_t>(nlmsg_total_size(sizeof(struct nlmsgerr)))};
+  struct nlmsghdr *hdr = nlmsg_put(msg.get(), 0, request->nlmsg_seq,
+                                   NLMSG_ERROR, sizeof(struct nlmsgerr), 0);
+  if (hdr == nullptr) {
+    throw std::bad_alloc();
+  }
+  auto *err = static_cast<struct nlmsgerr *>(nlmsg_data(hdr));
+  err->error = error;
+  err->msg = *request;
+  try {
+    server_ctx.sock.set_peer_port(peer_port);
+    server_ctx.sock.send_msg(msg);
+  } catch (std::runtime_error &exc) {
+    spdlog::debug("Failed to report error to port {}: {}", peer_port,
+                  exc.what());
+  }
+}
+
+void handle_request(ServerContext &server_ctx, u32 peer_port,
+                    struct nlmsghdr *hdr, struct nlattr **nl_attrs) {
+  struct nlattr *payload_attr = nl_attrs[ATTR_PAYLOAD];
+  struct nlattr *desc_attr = nl_attrs[ATTR_SHM_DESC];
+  u32 seq = hdr->nlmsg_seq;
+  // fire-and-forget clients don't ask for a response
+  bool want_response = (hdr->nlmsg_flags & NLM_F_ACK) != 0;
+  if (payload_attr != nullptr) {
+    spdlog::debug("Got non-empty payload, length {}", nla_len(payload_attr));
+    // don't rely on the peer to NUL-terminate the payload
+    spdlog::debug("Payload string: {}",
+                  std::string_view((const char *)nla_data(payload_attr),
+                                   strnlen((const char *)nla_data(payload_attr),
+                                           nla_len(payload_attr))));
+    if (want_response) {
+      // 6. assemble response and 7. send it
+      send_response(server_ctx, peer_port, seq, nla_data(payload_attr),
+                    nla_len(payload_attr));
+    }
+  } else if (desc_attr != nullptr) {
+    if (nla_len(desc_attr) != sizeof(nl::ShmDescriptor)) {
+      throw std::invalid_argument("malformed shared ring descriptor");
+    }
+    auto ring = server_ctx.shm_rings.find(peer_port);
+    if (ring == server_ctx.shm_rings.end()) {
+      throw std::invalid_argument(
+          fmt::format("port {} has no shared ring attached", peer_port));
+    }
+    nl::ShmDescriptor desc;
+    memcpy(&desc, nla_data(desc_attr), sizeof(desc));
+    const nl::u8 *payload = ring->second.read(desc);
+    spdlog::debug("Got shared ring payload, length {}", desc.length);
+    spdlog::debug("Payload string: {}",
+                  std::string_view((const char *)payload, desc.length));
+    ring->second.release(desc);
+    if (want_response) {
+      // payload stays in shared memory, don't echo it through the socket
+      send_response(server_ctx, peer_port, seq, nullptr, 0);
+    }
+  } else if (want_response) {
+    send_response(server_ctx, peer_port, seq, nullptr, 0);
+  }
+}
+
+void handle_shm_setup(ServerContext &server_ctx, u32 peer_port, u32 seq,
+                      struct ucred *creds, struct nlattr **nl_attrs) {
+  if (nl_attrs[ATTR_SHM_FD] == nullptr) {
+    throw std::invalid_argument("shared ring setup without fd");
+  }
+  // the ring is taken from the process that sent the request, never from
+  // one named in it
+  if (creds == nullptr) {
+    throw std::invalid_argument("shared ring setup without sender credentials");
+  }
+  if (nl_attrs[ATTR_SHM_PID] != nullptr &&
+      nla_get_u32(nl_attrs[ATTR_SHM_PID]) != static_cast<u32>(creds->pid)) {
+    throw std::invalid_argument(
+        fmt::format("shared ring pid {} isn't the sender's pid {}",
+                    nla_get_u32(nl_attrs[ATTR_SHM_PID]), creds->pid));
+  }
+  auto fd = static_cast<int>(nla_get_u32(nl_attrs[ATTR_SHM_FD]));
+  server_ctx.shm_rings.insert_or_assign(peer_port,
+                                        nl::ShmRing::attach(creds->pid, fd));
+  spdlog::info("Attached shared ring of port {}", peer_port);
+  send_response(server_ctx, peer_port, seq, nullptr, 0);
+}
+
+/*
+ * Put records into the client's dump until it is complete or the client's
+ * receive buffer is full.
+ * @return true once the dump is complete
+ */
+bool continue_dump(ServerContext &server_ctx, u32 peer_port,
+                   DumpSession &dump) {
+  nl::DumpWriter &writer = *dump.writer;
+  server_ctx.sock.set_peer_port(peer_port);
+  if (!writer.flush()) {
+    return false;
+  }
+  while (dump.next < server_ctx.table_size) {
+    writer.record().put_string(GenlApp::ATTR_RECORD,
+                               fmt::format("record #{}", dump.next));
+    dump.next++;
+    if (!writer.end_record(dump.next)) {
+      return false;
+    }
+  }
+  return writer.finish();
+}
+
+/*
+ * Advance a dump and account for its progress.
+ * @return true if the dump is over, successfully or not
+ */
+bool advance_dump(ServerContext &server_ctx, u32 peer_port,
+                  DumpSession &dump) {
+  auto now = std::chrono::steady_clock::now();
+  u64 sent = dump.writer->messages();
+  if (continue_dump(server_ctx, peer_port, dump)) {
+    spdlog::info("Dumped {} records in {} messages to port {}",
+                 dump.writer->records(), dump.writer->messages(), peer_port);
+    return true;
+  }
+  if (dump.writer->messages() != sent) {
+    dump.last_progress = now;
+  } else if (now - dump.last_progress > DUMP_STALL_TIMEOUT) {
+    spdlog::warn("Port {} stopped reading its dump, abandoning it", peer_port);
+    return true;
+  }
+  return false;
+}
+
+/*
+ * Stream the synthetic table to the client, starting at the requested cursor.
+ * Whatever doesn't fit into the client's receive buffer is sent later by
+ * resume_dumps(), so a slow client never stalls the others.
+ */
+void handle_dump(ServerContext &server_ctx, u32 peer_port,
+                 struct nlmsghdr *hdr, struct nlattr **nl_attrs) {
+  u64 start = 0;
+  if (nl_attrs[ATTR_DUMP_CURSOR] != nullptr) {
+    start = nla_get_u64(nl_attrs[ATTR_DUMP_CURSOR]);
+  }
+  if (start > server_ctx.table_size) {
+    throw std::invalid_argument(
+        fmt::format("dump cursor {} is past the end of the table", start));
+  }
+  // a new request replaces the client's unfinished dump
+  DumpSession &dump = server_ctx.dumps[peer_port];
+  dump = DumpSession{
+      std::make_unique<nl::DumpWriter>(server_ctx.sock,
+                                       GenlApp::CMD_DUMP_RESPONSE,
+                                       NETLINK_GENERIC, hdr->nlmsg_seq,
+                                       ATTR_DUMP_CURSOR),
+      start, std::chrono::steady_clock::now()};
+  try {
+    if (advance_dump(server_ctx, peer_port, dump)) {
+      server_ctx.dumps.erase(peer_port);
+    }
+  } catch (std::runtime_error &) {
+    server_ctx.dumps.erase(peer_port);
+    throw;
+  }
+}
+
+/*
+ * Continue dumps parked on a full client receive buffer.
+ * @return whether dumps are still waiting for their clients
+ */
+bool resume_dumps(ServerContext &server_ctx) {
+  for (auto it = server_ctx.dumps.begin(); it != server_ctx.dumps.end();) {
+    bool over;
+    try {
+      over = advance_dump(server_ctx, it->first, it->second);
+    } catch (std::runtime_error &exc) {
+      spdlog::warn("Dump to port {} failed: {}", it->first, exc.what());
+      over = true;
+    }
+    it = over ? server_ctx.dumps.erase(it) : std::next(it);
+  }
+  return !server_ctx.dumps.empty();
+}
+
+/*
+ * Continue parked dumps of all sockets.
+ * @return whether dumps are still waiting for their clients
+ */
+bool resume_dumps(std::vector<std::unique_ptr<ServerContext>> &server_ctxs) {
+  bool parked = false;
+  for (auto &server_ctx : server_ctxs) {
+    parked |= resume_dumps(*server_ctx);
+  }
+  return parked;
+}
+
+/*
+ * Detach shared rings of clients that exited without tearing them down.
+ */
+void reap_shm_rings(ServerContext &server_ctx) {
+  for (auto it = server_ctx.shm_rings.begin();
+       it != server_ctx.shm_rings.end();) {
+    if (it->second.owner_alive()) {
+      ++it;
+      continue;
+    }
+    spdlog::info("Detached shared ring of exited port {}", it->first);
+    it = server_ctx.shm_rings.erase(it);
+  }
+}
+
+void reap_shm_rings(std::vector<std::unique_ptr<ServerContext>> &server_ctxs) {
+  for (auto &server_ctx : server_ctxs) {
+    reap_shm_rings(*server_ctx);
+  }
+}
+
+void handle_message(ServerContext &server_ctx, struct nl_msg *msg) {
   struct genlmsghdr *genl_header = (genlmsghdr *)nlmsg_data(nlmsg_hdr(msg));
-  struct nlattr *nl_attrs[ATTR_MAX];
-  nla_parse(nl_attrs, ATTR_MAX, genlmsg_attrdata(genl_header, 0),
-            genlmsg_attrlen(genl_header, 0), NULL);
+  struct nlattr *nl_attrs[ATTR_MAX + 1];
+  // 5. check source pid
+  u32 peer_port = nlmsg_get_src(msg)->nl_pid;
+  u32 seq = nlmsg_hdr(msg)->nlmsg_seq;
   try {
-    if (genl_header->cmd != GenlApp::CMD_SERVER_REQUEST) {
+    int err = nla_parse(nl_attrs, ATTR_MAX, genlmsg_attrdata(genl_header, 0),
+                        genlmsg_attrlen(genl_header, 0),
+                        request_policy.data());
+    if (err < 0) {
       throw std::invalid_argument(
-          fmt::format("event cmd ({}) != CMD_SERVER_REQUEST ({}), skipping",
-                      genl_header->cmd, CMD_SERVER_REQUEST));
+          fmt::format("malformed attributes: {}", nl_geterror(err)));
     }
-    struct nlattr *payload_attr = nl_attrs[ATTR_PAYLOAD];
-    if (payload_attr != nullptr) {
-      spdlog::info("Got non-empty payload, length {}", nla_len(payload_attr));
-      spdlog::info("Payload string: {}", (char *)nla_data(payload_attr));
+    switch (genl_header->cmd) {
+    case GenlApp::CMD_SERVER_REQUEST:
+      handle_request(server_ctx, peer_port, nlmsg_hdr(msg), nl_attrs);
+      break;
+    case GenlApp::CMD_SHM_SETUP:
+      handle_shm_setup(server_ctx, peer_port, seq, nlmsg_get_creds(msg),
+                       nl_attrs);
+      break;
+    case GenlApp::CMD_DUMP_REQUEST:
+      handle_dump(server_ctx, peer_port, nlmsg_hdr(msg), nl_attrs);
+      break;
+    case GenlApp::CMD_SHM_TEARDOWN:
+      server_ctx.shm_rings.erase(peer_port);
+      spdlog::info("Detached shared ring of port {}", peer_port);
+      break;
+    default:
+      throw std::invalid_argument(
+          fmt::format("unexpected cmd ({}), skipping", genl_header->cmd));
     }
+    spdlog::debug("Handled request from port {}", peer_port);
   } catch (std::invalid_argument &exc) {
     spdlog::debug("Event payload is invalid: {}, skipping this message",
                   exc.what());
+    send_error(server_ctx, peer_port, nlmsg_hdr(msg), -EINVAL);
+  } catch (std::runtime_error &exc) {
+    // the client may already be gone, that must not bring the server down
+    spdlog::warn("Failed to handle request from port {}: {}", peer_port,
+                 exc.what());
+    send_error(server_ctx, peer_port, nlmsg_hdr(msg), -EIO);
+  }
+}
+
+nl::callback_result_t parse_request(struct nl_msg *msg, void *ctx) {
+  spdlog::debug("Received netlink message");
+  auto &server_ctx = *static_cast<ServerContext *>(ctx);
+  if (server_ctx.scheduler == nullptr) {
+    handle_message(server_ctx, msg);
+    return NL_SKIP;
+  }
+  // libnl frees the message once we return, the queue keeps a reference
+  auto [cls, queued] = server_ctx.scheduler->enqueue(msg, &server_ctx);
+  if (!queued) {
+    u32 peer_port = nlmsg_get_src(msg)->nl_pid;
+    spdlog::debug("Class {} queue is full, dropped request from port {}", cls,
+                  peer_port);
+    send_error(server_ctx, peer_port, nlmsg_hdr(msg), -ENOBUFS);
   }
   return NL_SKIP;
 }
 
-void server(u32 server_port) {
+/*
+ * Handle queued requests in weighted fair order.
+ * @return number of requests handled
+ */
+int handle_queued(RequestScheduler &scheduler, int budget) {
+  int handled = 0;
+  while (handled < budget) {
+    auto request = scheduler.queue.pop();
+    if (!request) {
+      break;
+    }
+    handle_message(*request->item.server_ctx, request->item.msg.get());
+    scheduler.handled(*request);
+    handled++;
+  }
+  return handled;
+}
+
+nl::callback_result_t parse_response(struct nl_msg *msg, void *ctx) {
+  struct genlmsghdr *genl_header = (genlmsghdr *)nlmsg_data(nlmsg_hdr(msg));
+  if (genl_header->cmd != GenlApp::CMD_SERVER_RESPONSE) {
+    spdlog::debug("cmd ({}) != CMD_SERVER_RESPONSE ({}), skipping",
+                  genl_header->cmd, CMD_SERVER_RESPONSE);
+    return NL_SKIP;
+  }
+  return NL_STOP;
+}
+
+/*
+ * Pin the calling thread to the given core.
+ */
+void pin_current_thread(int cpu) {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  if (ret != 0) {
+    throw std::runtime_error(fmt::format("Failed to pin thread to CPU {}: {}",
+                                         cpu, strerror(ret)));
+  }
+  spdlog::debug("Pinned thread to CPU {}", cpu);
+}
+
+/*
+ * Lock current and future pages in RAM so the hot path never page faults.
+ * Requires CAP_IPC_LOCK or a big enough RLIMIT_MEMLOCK, so failure is not
+ * fatal.
+ */
+void lock_memory() {
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    spdlog::warn("mlockall failed: {}, continuing with pageable memory",
+                 strerror(errno));
+    return;
+  }
+  spdlog::debug("Locked process memory");
+}
+
+// datagrams handled between two checks for parked dumps when busy-polling
+constexpr int BUSY_POLL_BATCH = 64;
+
+void server(u32 server_port, const ServerOptions &opts) {
   // 1. register family
   /*nl::genl::Family::register_family(GenlApp::FAMILY_NAME, true);*/
   /*spdlog::debug("Registered family {}", GenlApp::FAMILY_NAME);*/
@@ -46,50 +618,528 @@ void server(u32 server_port) {
   // 3. set listening port
   sock.set_local_port(server_port);
   spdlog::debug("Opened netlink socket with port {}", server_port);
+  ServerContext server_ctx{sock, opts};
+  if (!opts.capture_path.empty()) {
+    sock.set_capture(std::make_shared<nl::CaptureWriter>(opts.capture_path));
+  }
+  if (opts.cpu >= 0) {
+    pin_current_thread(opts.cpu);
+  }
+  if (opts.low_latency) {
+    // everything the hot path needs is allocated at this point
+    lock_memory();
+  }
   spdlog::debug("Waiting for recv...");
-  // 4. wait for recv
-  sock.recv_msg({parse_request, nullptr});
-  spdlog::debug("Message received, shutting down...");
-  // 5. check source pid
-  // TODO
-  // 6. assemble response
-  // TODO
-  // 7. send response
-  // TODO
+  // 4. wait for recv, requests are answered from the callback; the socket is
+  // non-blocking so parked dumps can be resumed in between
+  if (opts.low_latency) {
+    // busy-poll, recv_pending() returns right away on an empty socket
+    sock.set_nonblocking(true);
+    sock.set_recv_handler({parse_request, &server_ctx});
+    auto next_reap = std::chrono::steady_clock::now() + SHM_REAP_INTERVAL;
+    for (;;) {
+      sock.recv_pending(BUSY_POLL_BATCH);
+      resume_dumps(server_ctx);
+      if (std::chrono::steady_clock::now() >= next_reap) {
+        reap_shm_rings(server_ctx);
+        next_reap += SHM_REAP_INTERVAL;
+      }
+    }
+  }
+  nl::Reactor reactor;
+  reactor.add_socket(sock, {parse_request, &server_ctx});
+  reactor.add_timer(
+      SHM_REAP_INTERVAL, [&server_ctx] { reap_shm_rings(server_ctx); }, true);
+  bool parked = false;
+  for (;;) {
+    reactor.run_once(parked ? DUMP_RETRY_MS : -1);
+    parked = resume_dumps(server_ctx);
+  }
+}
+
+/*
+ * Parse a PORT:CLASS traffic class assignment.
+ */
+std::pair<u32, u32> parse_port_class(const std::string &spec) {
+  size_t colon = spec.find(':');
+  try {
+    if (colon != std::string::npos) {
+      return {static_cast<u32>(std::stoul(spec.substr(0, colon))),
+              static_cast<u32>(std::stoul(spec.substr(colon + 1)))};
+    }
+  } catch (std::logic_error &) {
+    // reported below
+  }
+  throw std::runtime_error(
+      fmt::format("invalid port class '{}', expected PORT:CLASS", spec));
+}
+
+void server_multi(const std::vector<u32> &server_ports,
+                  const ServerOptions &opts) {
+  // one socket per port, all of them are served by a single thread
+  std::vector<std::unique_ptr<nl::Socket>> socks;
+  std::vector<std::unique_ptr<ServerContext>> server_ctxs;
+  nl::Reactor reactor;
+  std::shared_ptr<nl::CaptureWriter> capture;
+  if (!opts.capture_path.empty()) {
+    capture = std::make_shared<nl::CaptureWriter>(opts.capture_path);
+  }
+  std::optional<RequestScheduler> scheduler;
+  if (!opts.class_weights.empty()) {
+    scheduler.emplace(opts);
+  }
+  for (u32 port : server_ports) {
+    auto sock = std::make_unique<nl::Socket>(NETLINK_USERSOCK, port);
+    sock->set_local_port(port);
+    sock->set_capture(capture);
+    auto server_ctx = std::make_unique<ServerContext>(*sock, opts);
+    if (scheduler) {
+      server_ctx->scheduler = &*scheduler;
+    }
+    reactor.add_socket(*sock, {parse_request, server_ctx.get()});
+    spdlog::debug("Opened netlink socket with port {}", port);
+    socks.push_back(std::move(sock));
+    server_ctxs.push_back(std::move(server_ctx));
+  }
+  spdlog::debug("Waiting for recv on {} sockets...", socks.size());
+  reactor.add_timer(
+      SHM_REAP_INTERVAL, [&server_ctxs] { reap_shm_rings(server_ctxs); }, true);
+  bool parked = false;
+  if (!scheduler) {
+    for (;;) {
+      reactor.run_once(parked ? DUMP_RETRY_MS : -1);
+      parked = resume_dumps(server_ctxs);
+    }
+  }
+  spdlog::info("Scheduling requests over {} traffic classes",
+               scheduler->queue.num_classes());
+  reactor.add_timer(
+      std::chrono::seconds(opts.stats_interval),
+      [&scheduler] { scheduler->queue.report(); }, true);
+  for (;;) {
+    // sockets are drained into the class queues, requests wait there, so
+    // don't block while some are pending
+    int timeout_ms = !scheduler->queue.empty() ? 0
+                     : parked                  ? DUMP_RETRY_MS
+                                               : -1;
+    reactor.run_once(timeout_ms);
+    handle_queued(*scheduler, HANDLE_BATCH);
+    parked = resume_dumps(server_ctxs);
+  }
+}
+
+struct ClientOptions {
+  int rtt_samples = 0;       // wait for responses and report latency if > 0
+  size_t payload_size = 0;   // repeat the message up to this many bytes if > 0
+  size_t shm_size = 0;       // pass payloads through a shared ring if > 0
+  int count = 1;             // requests to send without waiting for responses
+  size_t coalesce_bytes = 0; // coalesce requests into datagrams if > 0
+  std::chrono::microseconds coalesce_delay{100};
+  std::string capture_path; // record traffic to this pcap file if not empty
+  int priority = -1;        // traffic class to ask the server for if >= 0
+};
+
+/*
+ * Create a shared ring and have the server attach to it. Payloads written to
+ * the ring never cross the socket afterwards.
+ */
+nl::ShmRing setup_shm_ring(nl::Socket &sock, u32 server_port, size_t size) {
+  nl::ShmRing ring = nl::ShmRing::create(size);
+  nl::Message msg;
+  msg.put_header(GenlApp::CMD_SHM_SETUP, NETLINK_GENERIC, server_port)
+      .put_attr<u32>(GenlApp::ATTR_SHM_PID, static_cast<u32>(getpid()))
+      .put_attr<u32>(GenlApp::ATTR_SHM_FD, static_cast<u32>(ring.fd()));
+  sock.send_msg(msg);
+  sock.recv_msg({parse_response, nullptr});
+  if (sock.recv_ctx.nl_recv_status != nl::RecvStatus::FINISH) {
+    throw std::runtime_error("server failed to attach shared ring");
+  }
+  spdlog::debug("Server attached shared ring of {} bytes", size);
+  return ring;
 }
 
-void client(u32 server_port, std::string &payload) {
+/*
+ * Assemble a request, putting the payload into the shared ring when there is
+ * one with enough free space and inline into the message otherwise.
+ * @param priority - traffic class to ask the server for, -1 to leave it to
+ * the server
+ */
+nl::Message make_request(u32 server_port, const std::string &payload,
+                         nl::ShmRing *ring, int priority) {
+  // room for the priority attribute
+  size_t extra = priority >= 0 ? nla_total_size(sizeof(u32)) : 0;
+  std::optional<nl::Message> msg;
+  if (ring != nullptr) {
+    auto desc = ring->write(payload.c_str(), (u32)payload.length() + 1);
+    // a payload too long to be inlined waits for the server to make room
+    auto deadline = std::chrono::steady_clock::now() + SHM_FULL_TIMEOUT;
+    while (!desc && payload.length() > MAX_INLINE_PAYLOAD) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        throw std::runtime_error(
+            "shared ring stayed full, is the server stuck?");
+      }
+      std::this_thread::yield();
+      desc = ring->write(payload.c_str(), (u32)payload.length() + 1);
+    }
+    if (desc) {
+      msg.emplace(msg_size_for_attr(sizeof(*desc)) + extra);
+      msg->put_header(GenlApp::CMD_SERVER_REQUEST, NETLINK_GENERIC,
+                      server_port)
+          .put_attr(GenlApp::ATTR_SHM_DESC, *desc);
+    } else {
+      spdlog::warn("Shared ring is full, sending payload inline");
+    }
+  }
+  if (!msg) {
+    msg.emplace(msg_size_for_attr(payload.length() + 1) + extra);
+    msg->put_header(GenlApp::CMD_SERVER_REQUEST, NETLINK_GENERIC, server_port)
+        .put_string(GenlApp::ATTR_PAYLOAD, payload);
+  }
+  if (priority >= 0) {
+    msg->put_attr<u32>(GenlApp::ATTR_PRIORITY, static_cast<u32>(priority));
+  }
+  return std::move(*msg);
+}
+
+/*
+ * Client side of the app on an already created socket.
+ */
+void run_client(nl::Socket &sock, u32 server_port, std::string payload,
+                const ClientOptions &opts) {
+  // 2. set socket peer port
+  sock.set_peer_port(server_port);
+  spdlog::debug("Opened netlink socket with peer port {}", server_port);
+  if (!opts.capture_path.empty()) {
+    sock.set_capture(std::make_shared<nl::CaptureWriter>(opts.capture_path));
+  }
+  if (opts.payload_size > 0 && !payload.empty()) {
+    while (payload.length() < opts.payload_size) {
+      payload += payload;
+    }
+    payload.resize(opts.payload_size);
+  }
+  if (payload.length() > MAX_INLINE_PAYLOAD &&
+      opts.shm_size < payload.length() + 1) {
+    throw std::runtime_error(fmt::format(
+        "payload of {} bytes doesn't fit into a netlink attribute (max {}), "
+        "pass it through a shared ring of at least {} bytes (--shm-size)",
+        payload.length(), MAX_INLINE_PAYLOAD, payload.length() + 1));
+  }
+  sock.set_buffer_size(SOCKET_BUFFER_SIZE, SOCKET_BUFFER_SIZE);
+  std::optional<nl::ShmRing> ring;
+  if (opts.shm_size > 0) {
+    ring = setup_shm_ring(sock, server_port, opts.shm_size);
+  }
+  nl::ShmRing *ring_ptr = ring ? &*ring : nullptr;
+  if (opts.coalesce_bytes > 0) {
+    sock.enable_coalescing(opts.coalesce_bytes, opts.coalesce_delay);
+  }
+  if (opts.rtt_samples == 0) {
+    // fire and forget, tell the server not to respond
+    sock.set_auto_ack(false);
+    for (int i = 0; i < opts.count; i++) {
+      // 3. assemble a request message
+      nl::Message msg =
+          make_request(server_port, payload, ring_ptr, opts.priority);
+      // 4. send it
+      sock.send_msg(msg);
+    }
+    sock.flush();
+    spdlog::debug("{} messages sent, shutting down...", opts.count);
+  } else {
+    // measure round-trip latency: send a request and wait for its response
+    // rtt_samples times, then report the distribution
+    LatencyHistogram rtt;
+    auto bench_start = std::chrono::steady_clock::now();
+    for (int i = 0; i < opts.rtt_samples; i++) {
+      auto start = std::chrono::steady_clock::now();
+      nl::Message msg =
+          make_request(server_port, payload, ring_ptr, opts.priority);
+      sock.send_msg(msg);
+      sock.recv_msg({parse_response, nullptr});
+      if (sock.recv_ctx.nl_recv_status != nl::RecvStatus::FINISH) {
+        throw std::runtime_error("server failed to handle request");
+      }
+      rtt.record(std::chrono::steady_clock::now() - start);
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - bench_start;
+    rtt.report("round-trip");
+    spdlog::info("throughput: {:.1f} MB/s of payload",
+                 static_cast<double>(payload.length()) * opts.rtt_samples /
+                     elapsed.count() / 1e6);
+  }
+  if (ring) {
+    nl::Message msg;
+    msg.put_header(GenlApp::CMD_SHM_TEARDOWN, NETLINK_GENERIC, server_port);
+    sock.send_msg(msg);
+  }
+}
+
+void client(u32 server_port, std::string payload, const ClientOptions &opts) {
   // 1. create socket with family name
   // TODO: create class nl::genl::Socket
   nl::Socket sock{NETLINK_USERSOCK};
-  // 2. set socket peer port
+  run_client(sock, server_port, std::move(payload), opts);
+}
+
+struct DumpContext {
+  u64 cursor = 0;  // where to resume if the dump gets interrupted
+  u64 records = 0; // records received so far
+  u64 limit = 0;   // stop after this many records if > 0
+  bool stopped = false;
+};
+
+/*
+ * Invoked for every part of a dump as it arrives.
+ */
+nl::callback_result_t parse_dump_response(struct nl_msg *msg, void *ctx) {
+  auto &dump_ctx = *static_cast<DumpContext *>(ctx);
+  struct genlmsghdr *genl_header = (genlmsghdr *)nlmsg_data(nlmsg_hdr(msg));
+  if (genl_header->cmd != GenlApp::CMD_DUMP_RESPONSE) {
+    spdlog::debug("cmd ({}) != CMD_DUMP_RESPONSE ({}), skipping",
+                  genl_header->cmd, CMD_DUMP_RESPONSE);
+    return NL_SKIP;
+  }
+  struct nlattr *attr;
+  int rem;
+  nla_for_each_attr(attr, genlmsg_attrdata(genl_header, 0),
+                    genlmsg_attrlen(genl_header, 0), rem) {
+    if (nla_type(attr) == ATTR_RECORD) {
+      spdlog::info("{}", nla_get_string(attr));
+      dump_ctx.records++;
+    } else if (nla_type(attr) == ATTR_DUMP_CURSOR) {
+      dump_ctx.cursor = nla_get_u64(attr);
+    }
+  }
+  if (dump_ctx.limit > 0 && dump_ctx.records >= dump_ctx.limit) {
+    dump_ctx.stopped = true;
+    return NL_STOP;
+  }
+  return NL_OK;
+}
+
+void client_dump(u32 server_port, u64 cursor, u64 limit) {
+  nl::Socket sock{NETLINK_USERSOCK};
   sock.set_peer_port(server_port);
-  spdlog::debug("Opened netlink socket with peer port {}", server_port);
-  // 3. assemble a request message
   nl::Message msg;
-  msg.put_header(GenlApp::CMD_SERVER_REQUEST, NETLINK_GENERIC, server_port)
-      .put_string(GenlApp::ATTR_PAYLOAD, payload);
-  spdlog::debug("Assembled request message, sending...");
-  // 4. send it
+  msg.put_header(GenlApp::CMD_DUMP_REQUEST, NETLINK_GENERIC, server_port)
+      .add_flags(NLM_F_DUMP)
+      .put_attr<u64>(GenlApp::ATTR_DUMP_CURSOR, cursor);
   sock.send_msg(msg);
-  spdlog::debug("Message sent, shutting down...");
-  // 5. wait for response
-  // TODO
+  DumpContext dump_ctx{.cursor = cursor, .limit = limit};
+  sock.recv_msg({parse_dump_response, &dump_ctx});
+  if (sock.recv_ctx.nl_recv_status == nl::RecvStatus::ERROR) {
+    // e.g. a cursor past the end of the table
+    throw std::runtime_error(
+        fmt::format("server failed the dump after {} records, cursor {}",
+                    dump_ctx.records, dump_ctx.cursor));
+  }
+  if (sock.recv_ctx.nl_recv_status == nl::RecvStatus::FINISH &&
+      !dump_ctx.stopped) {
+    spdlog::info("Dump complete, {} records", dump_ctx.records);
+  } else {
+    spdlog::info("Dump interrupted after {} records, resume with --cursor {}",
+                 dump_ctx.records, dump_ctx.cursor);
+  }
+}
+
+struct ReplayOptions {
+  bool original_timing = false; // keep the captured inter-datagram gaps
+  nl::CaptureDirection dir = nl::CaptureDirection::TX; // datagrams to resend
+  int loops = 1;
+};
+
+// how many response datagrams to discard at once while replaying
+constexpr int REPLAY_DRAIN_BUDGET = 256;
+
+/*
+ * Resend the datagrams of a capture to the server, either back to back or
+ * with the captured timing.
+ */
+void replay(const std::string &path, u32 server_port,
+            const ReplayOptions &opts) {
+  nl::CaptureReader reader{path};
+  nl::Socket sock{NETLINK_USERSOCK};
+  sock.set_peer_port(server_port);
+  // captured datagrams may be coalesced or carry 64 KiB payloads, more than
+  // libnl's default send buffer takes
+  sock.set_buffer_size(SOCKET_BUFFER_SIZE, SOCKET_BUFFER_SIZE);
+  // responses are discarded, but they must be drained: the server drops
+  // them once our receive buffer is full
+  sock.set_nonblocking(true);
+  sock.set_recv_handler({nullptr, nullptr});
+
+  u64 datagrams = 0;
+  u64 bytes = 0;
+  u64 truncated = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int loop = 0; loop < opts.loops; loop++) {
+    reader.rewind();
+    std::optional<std::chrono::nanoseconds> first_timestamp;
+    auto loop_start = std::chrono::steady_clock::now();
+    while (auto rec = reader.next()) {
+      if (rec->dir != opts.dir || rec->nl_protocol != NETLINK_USERSOCK) {
+        continue;
+      }
+      if (rec->len < rec->orig_len) {
+        // cut off by the capture's snap length, resending it would only
+        // hand the server a malformed datagram
+        truncated++;
+        continue;
+      }
+      if (opts.original_timing) {
+        if (!first_timestamp) {
+          first_timestamp = rec->timestamp;
+        }
+        std::this_thread::sleep_until(loop_start +
+                                      (rec->timestamp - *first_timestamp));
+      }
+      while (!sock.send_raw(rec->data, rec->len)) {
+        // server's receive buffer is full, make sure it isn't waiting on us
+        if (sock.recv_pending(REPLAY_DRAIN_BUDGET) == 0) {
+          std::this_thread::yield();
+        }
+      }
+      datagrams++;
+      bytes += rec->len;
+      if (datagrams % REPLAY_DRAIN_BUDGET == 0) {
+        sock.recv_pending(REPLAY_DRAIN_BUDGET);
+      }
+    }
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  if (truncated > 0) {
+    spdlog::warn("Skipped {} truncated datagrams", truncated);
+  }
+  spdlog::info("Replayed {} datagrams ({} bytes) in {:.3f}s: {:.0f} "
+               "datagrams/s, {:.1f} MB/s",
+               datagrams, bytes, elapsed.count(), datagrams / elapsed.count(),
+               bytes / elapsed.count() / 1e6);
+}
+
+// port of the in-process server, loopback ports don't clash with the kernel's
+constexpr u32 LOOPBACK_SERVER_PORT = 1000;
+// how often the in-process server checks whether the benchmark is over
+constexpr int LOOPBACK_POLL_MS = 10;
+// datagrams handled at once when draining the in-process server
+constexpr int LOOPBACK_DRAIN_BUDGET = 256;
+
+/*
+ * Run the server and clients as threads of this process, connected through
+ * the in-memory loopback transport instead of kernel sockets. Everything but
+ * the transport is the same code, so this measures the library and handler
+ * overhead without syscalls and scheduler noise.
+ */
+void loopback_bench(const std::string &payload, int clients,
+                    const ServerOptions &server_opts,
+                    const ClientOptions &client_opts) {
+  auto hub = std::make_shared<nl::LoopbackHub>();
+  nl::Socket server_sock{std::make_unique<nl::LoopbackTransport>(hub),
+                         NETLINK_USERSOCK, LOOPBACK_SERVER_PORT};
+  ServerContext server_ctx{server_sock, server_opts};
+  nl::Reactor reactor;
+  reactor.add_socket(server_sock, {parse_request, &server_ctx});
+
+  std::atomic<bool> done{false};
+  auto start = std::chrono::steady_clock::now();
+  std::thread server_thread{[&] {
+    bool parked = false;
+    while (!done.load(std::memory_order_relaxed)) {
+      reactor.run_once(parked ? DUMP_RETRY_MS : LOOPBACK_POLL_MS);
+      parked = resume_dumps(server_ctx);
+    }
+    // handle fire-and-forget requests still queued
+    while (server_sock.recv_pending(LOOPBACK_DRAIN_BUDGET) > 0) {
+    }
+  }};
+  std::vector<std::thread> client_threads;
+  for (int i = 0; i < clients; i++) {
+    client_threads.emplace_back([&] {
+      try {
+        nl::Socket sock{std::make_unique<nl::LoopbackTransport>(hub),
+                        NETLINK_USERSOCK};
+        run_client(sock, LOOPBACK_SERVER_PORT, payload, client_opts);
+      } catch (std::runtime_error &e) {
+        spdlog::error("Loopback client failed: {}", e.what());
+      }
+    });
+  }
+  for (auto &thread : client_threads) {
+    thread.join();
+  }
+  done.store(true, std::memory_order_relaxed);
+  server_thread.join();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  spdlog::info("Loopback bench with {} clients done in {:.3f}s", clients,
+               elapsed.count());
 }
 
 }; // namespace GenlApp
 
 int main(int argc, char **argv) {
   spdlog::set_pattern("[%H:%M:%S.%e][%^%l%$] %v");
-  spdlog::set_level(spdlog::level::debug);
 
   CLI::App app{"Generic Netlink client-server app"};
 
+  std::string log_level = "debug";
+  app.add_option("--log-level", log_level,
+                 "Log level (trace, debug, info, warn, error, off)")
+      ->capture_default_str();
+  bool trace = false;
+  app.add_flag("--trace", trace,
+               "Keep the last netlink messages of each thread in memory and "
+               "dump them on crash or SIGUSR1");
+
   u32 server_port;
+  std::vector<u32> server_ports;
   auto *server_subcmd = app.add_subcommand("server", "Run as server");
-  server_subcmd->add_option("port", server_port, "Port number to listen on")
+  server_subcmd
+      ->add_option("port", server_ports,
+                   "Port number(s) to listen on, several ports are served by "
+                   "one thread")
       ->required()
       ->check(CLI::PositiveNumber);
+  GenlApp::ServerOptions server_opts;
+  server_subcmd->add_flag(
+      "--low-latency", server_opts.low_latency,
+      "Busy-poll the socket instead of sleeping in recv, preallocate "
+      "responses and lock memory");
+  server_subcmd
+      ->add_option("--cpu", server_opts.cpu,
+                   "Pin the receive/handler thread to this core")
+      ->check(CLI::NonNegativeNumber);
+  server_subcmd
+      ->add_option("--table-size", server_opts.table_size,
+                   "Number of records served by dumps")
+      ->capture_default_str();
+  server_subcmd->add_option("--capture", server_opts.capture_path,
+                            "Record traffic to this pcap file");
+  server_subcmd
+      ->add_option("--weights", server_opts.class_weights,
+                   "Comma-separated weights of the traffic classes; enables "
+                   "weighted fair scheduling of requests across classes")
+      ->delimiter(',')
+      ->check(CLI::PositiveNumber);
+  std::vector<std::string> port_classes;
+  server_subcmd->add_option(
+      "--port-class", port_classes,
+      "PORT:CLASS, put requests from this sender port into a traffic class "
+      "unless they ask for one (default class 0). Senders sharing a class "
+      "share its queue, give a sender a class of its own to keep its floods "
+      "from crowding out others");
+  server_subcmd
+      ->add_option("--queue-depth", server_opts.queue_depth,
+                   "Max requests waiting per traffic class, more are dropped")
+      ->check(CLI::PositiveNumber)
+      ->capture_default_str();
+  server_subcmd
+      ->add_option("--stats-interval", server_opts.stats_interval,
+                   "Seconds between per-class queue and latency reports")
+      ->check(CLI::PositiveNumber)
+      ->capture_default_str();
 
   std::string message;
   auto *client_subcmd = app.add_subcommand("client", "Run as client");
@@ -99,17 +1149,156 @@ int main(int argc, char **argv) {
       ->check(CLI::PositiveNumber);
   client_subcmd->add_option("message", message, "Message to send to server")
       ->required();
+  GenlApp::ClientOptions client_opts;
+  client_subcmd
+      ->add_option("--rtt-samples", client_opts.rtt_samples,
+                   "Wait for responses and report round-trip latency "
+                   "distribution over this many requests")
+      ->check(CLI::PositiveNumber);
+  client_subcmd
+      ->add_option("--payload-size", client_opts.payload_size,
+                   "Repeat the message to make a payload of this many bytes")
+      ->check(CLI::PositiveNumber);
+  client_subcmd
+      ->add_option("--shm-size", client_opts.shm_size,
+                   "Pass payloads through a shared memory ring of this many "
+                   "bytes instead of the socket")
+      ->check(CLI::PositiveNumber);
+  client_subcmd
+      ->add_option("--count", client_opts.count,
+                   "Number of requests to send without waiting for responses")
+      ->check(CLI::PositiveNumber);
+  client_subcmd
+      ->add_option("--coalesce-bytes", client_opts.coalesce_bytes,
+                   "Coalesce requests into datagrams of up to this many bytes")
+      ->check(CLI::PositiveNumber);
+  client_subcmd->add_option("--capture", client_opts.capture_path,
+                            "Record traffic to this pcap file");
+  client_subcmd
+      ->add_option("--priority", client_opts.priority,
+                   "Ask the server to schedule requests in this traffic "
+                   "class")
+      ->check(CLI::NonNegativeNumber);
+  int coalesce_us = 100;
+  client_subcmd
+      ->add_option("--coalesce-us", coalesce_us,
+                   "Max time a coalesced request may wait before being sent")
+      ->check(CLI::NonNegativeNumber)
+      ->capture_default_str();
+
+  u64 dump_cursor = 0;
+  u64 dump_limit = 0;
+  auto *dump_subcmd = app.add_subcommand("dump", "Dump the server's table");
+  dump_subcmd
+      ->add_option("port", server_port, "Server port number to connect to")
+      ->required()
+      ->check(CLI::PositiveNumber);
+  dump_subcmd->add_option("--cursor", dump_cursor,
+                          "Resume an interrupted dump from this cursor");
+  dump_subcmd->add_option("--limit", dump_limit,
+                          "Stop after receiving this many records");
+
+  std::string replay_path;
+  std::string replay_direction = "tx";
+  GenlApp::ReplayOptions replay_opts;
+  auto *replay_subcmd =
+      app.add_subcommand("replay", "Resend a captured trace to the server");
+  replay_subcmd->add_option("file", replay_path, "Capture file to replay")
+      ->required()
+      ->check(CLI::ExistingFile);
+  replay_subcmd
+      ->add_option("port", server_port, "Server port number to send to")
+      ->required()
+      ->check(CLI::PositiveNumber);
+  replay_subcmd->add_flag("--original-timing", replay_opts.original_timing,
+                          "Keep captured timing instead of sending as fast "
+                          "as possible");
+  replay_subcmd
+      ->add_option("--direction", replay_direction,
+                   "Replay datagrams sent (tx, client-side capture) or "
+                   "received (rx, server-side capture)")
+      ->check(CLI::IsMember({"tx", "rx"}))
+      ->capture_default_str();
+  replay_subcmd
+      ->add_option("--loops", replay_opts.loops,
+                   "Replay the capture this many times")
+      ->check(CLI::PositiveNumber);
+
+  std::string bench_message = "ping";
+  int bench_clients = 1;
+  auto *bench_subcmd = app.add_subcommand(
+      "loopback-bench",
+      "Run server and clients in this process over the in-memory loopback "
+      "transport");
+  bench_subcmd->add_option("message", bench_message, "Message to send")
+      ->capture_default_str();
+  bench_subcmd
+      ->add_option("--clients", bench_clients, "Number of client threads")
+      ->check(CLI::PositiveNumber)
+      ->capture_default_str();
+  bench_subcmd
+      ->add_option("--rtt-samples", client_opts.rtt_samples,
+                   "Round trips per client to report latency over")
+      ->check(CLI::PositiveNumber);
+  bench_subcmd
+      ->add_option("--count", client_opts.count,
+                   "Requests per client to send without waiting for "
+                   "responses")
+      ->check(CLI::PositiveNumber);
+  bench_subcmd
+      ->add_option("--payload-size", client_opts.payload_size,
+                   "Repeat the message to make a payload of this many bytes")
+      ->check(CLI::PositiveNumber);
+  bench_subcmd
+      ->add_option("--coalesce-bytes", client_opts.coalesce_bytes,
+                   "Coalesce requests into datagrams of up to this many bytes")
+      ->check(CLI::PositiveNumber);
+  bench_subcmd
+      ->add_option("--coalesce-us", coalesce_us,
+                   "Max time a coalesced request may wait before being sent")
+      ->check(CLI::NonNegativeNumber)
+      ->capture_default_str();
 
   CLI11_PARSE(app, argc, argv);
+  replay_opts.dir = replay_direction == "rx" ? nl::CaptureDirection::RX
+                                             : nl::CaptureDirection::TX;
+  client_opts.coalesce_delay = std::chrono::microseconds(coalesce_us);
+  spdlog::set_level(spdlog::level::from_str(log_level));
 
   try {
+    if (trace) {
+      nl::trace::install_crash_handler();
+      nl::trace::install_dump_signal(SIGUSR1);
+      nl::trace::enable();
+    }
     if (*server_subcmd) {
-      spdlog::info("Starting server on port {}...", server_port);
-      GenlApp::server(server_port);
+      for (const auto &port_class : port_classes) {
+        server_opts.port_classes.insert(
+            GenlApp::parse_port_class(port_class));
+      }
+      if (server_ports.size() == 1 && server_opts.class_weights.empty()) {
+        spdlog::info("Starting server on port {}...", server_ports.front());
+        GenlApp::server(server_ports.front(), server_opts);
+      } else {
+        spdlog::info("Starting server on {} ports...", server_ports.size());
+        if (server_opts.low_latency || server_opts.cpu >= 0) {
+          spdlog::warn("Busy polling and --cpu only apply to a single port "
+                       "without --weights");
+        }
+        GenlApp::server_multi(server_ports, server_opts);
+      }
     } else if (*client_subcmd) {
-      GenlApp::client(server_port, message);
+      GenlApp::client(server_port, message, client_opts);
+    } else if (*dump_subcmd) {
+      GenlApp::client_dump(server_port, dump_cursor, dump_limit);
+    } else if (*replay_subcmd) {
+      GenlApp::replay(replay_path, server_port, replay_opts);
+    } else if (*bench_subcmd) {
+      GenlApp::loopback_bench(bench_message, bench_clients, server_opts,
+                              client_opts);
     } else {
-      spdlog::error("Either 'server' or 'client' subcommand must be provided");
+      spdlog::error("One of 'server', 'client', 'dump', 'replay' or "
+                    "'loopback-bench' subcommands must be provided");
       std::cout << app.help() << '\n';
       return 1;
     }
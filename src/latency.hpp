@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <libnl++/wlanapp_common.hpp>
+#include <spdlog/spdlog.h>
+#include <string>
+
+namespace GenlApp {
+
+using nl::u64;
+
+/*
+ * Log-linear latency histogram with a fixed memory footprint: every power of
+ * two range is split into SUB_BUCKETS linear buckets, so reported percentiles
+ * are within ~6% of the real value no matter how many samples are recorded.
+ */
+class LatencyHistogram {
+  static constexpr int SUB_BUCKET_BITS = 4;
+  static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static constexpr int NUM_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+  std::array<u64, NUM_BUCKETS> buckets{};
+  u64 total = 0;
+  u64 min_ns = UINT64_MAX;
+  u64 max_ns = 0;
+  u64 sum_ns = 0;
+
+  static int bucket_index(u64 ns) {
+    if (ns < SUB_BUCKETS) {
+      return static_cast<int>(ns);
+    }
+    int msb = 63 - std::countl_zero(ns);
+    int shift = msb - SUB_BUCKET_BITS;
+    int sub = static_cast<int>((ns >> shift) & (SUB_BUCKETS - 1));
+    return (shift + 1) * SUB_BUCKETS + sub;
+  }
+
+  // upper bound of the values that land in the given bucket
+  static u64 bucket_upper_bound(int idx) {
+    if (idx < SUB_BUCKETS) {
+      return static_cast<u64>(idx);
+    }
+    int shift = idx / SUB_BUCKETS - 1;
+    u64 sub = static_cast<u64>(idx % SUB_BUCKETS) | SUB_BUCKETS;
+    return ((sub + 1) << shift) - 1;
+  }
+
+public:
+  void record(std::chrono::nanoseconds latency) {
+    u64 ns = latency.count() > 0 ? static_cast<u64>(latency.count()) : 0;
+    buckets[bucket_index(ns)]++;
+    total++;
+    sum_ns += ns;
+    min_ns = std::min(min_ns, ns);
+    max_ns = std::max(max_ns, ns);
+  }
+
+  u64 count() const { return total; }
+
+  /*
+   * @param p - percentile in range [0, 100]
+   * @return latency in nanoseconds below which p percent of samples fall
+   */
+  u64 percentile(double p) const {
+    if (total == 0) {
+      return 0;
+    }
+    // nearest rank: the smallest sample with at least p percent of samples
+    // at or below it; multiply first so whole percentages stay exact
+    auto rank =
+        static_cast<u64>(std::ceil(p * static_cast<double>(total) / 100.0));
+    rank = std::clamp<u64>(rank, 1, total);
+    u64 seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+      seen += buckets[i];
+      if (seen >= rank) {
+        return std::min(bucket_upper_bound(i), max_ns);
+      }
+    }
+    return max_ns;
+  }
+
+  void reset() { *this = LatencyHistogram{}; }
+
+  void report(const std::string &name) const {
+    if (total == 0) {
+      spdlog::info("{}: no samples", name);
+      return;
+    }
+    spdlog::info("{}: n={} min={:.1f}us avg={:.1f}us p50={:.1f}us "
+                 "p90={:.1f}us p99={:.1f}us p99.9={:.1f}us max={:.1f}us",
+                 name, total, min_ns / 1e3,
+                 static_cast<double>(sum_ns) / static_cast<double>(total) / 1e3,
+                 percentile(50) / 1e3, percentile(90) / 1e3,
+                 percentile(99) / 1e3, percentile(99.9) / 1e3, max_ns / 1e3);
+  }
+};
+
+} // namespace GenlApp
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <latency.hpp>
+#include <libnl++/wlanapp_common.hpp>
+#include <optional>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <vector>
+
+namespace GenlApp {
+
+using nl::u32;
+using nl::u64;
+
+/*
+ * Weighted fair queuing over a fixed set of traffic classes, implemented as
+ * deficit round robin: every turn a class is granted weight * quantum bytes of
+ * credit and may dequeue items as long as their cost fits into its credit.
+ * Over time each backlogged class gets a share of the handler proportional to
+ * its weight, at O(1) per item, and an idle class can't bank credit for
+ * later.
+ *
+ * Every class has its own bounded queue; items arriving at a full queue are
+ * dropped, so a flooding class only ever loses its own traffic. Within a
+ * class items are handled in arrival order with no fairness between their
+ * senders: a flooding sender crowds out everyone in its class, isolating it
+ * takes a class of its own.
+ */
+template <typename Item> class FairQueue {
+  using clock = std::chrono::steady_clock;
+
+public:
+  struct Dequeued {
+    Item item;
+    size_t cls;
+    clock::time_point enqueued;
+  };
+
+private:
+  struct Entry {
+    Item item;
+    size_t cost;
+    clock::time_point enqueued;
+  };
+
+  // counters since the last report
+  struct ClassStats {
+    u64 handled = 0;
+    u64 dropped = 0;
+    size_t max_depth = 0;
+    LatencyHistogram latency; // enqueue to end of handling
+  };
+
+  struct Class {
+    u32 weight = 0;
+    std::deque<Entry> queue;
+    size_t deficit = 0;
+    ClassStats stats;
+  };
+
+  std::vector<Class> classes;
+  size_t max_depth;
+  size_t quantum;
+  size_t pending = 0;
+  size_t current = 0; // class whose turn it is
+  bool turn_granted = false;
+
+  void _next_turn() {
+    current = (current + 1) % classes.size();
+    turn_granted = false;
+  }
+
+public:
+  /*
+   * FairQueue ctor.
+   * @arg weights - relative share of each class, at least one class
+   * @arg max_depth - max items queued per class
+   * @arg quantum - credit per unit of weight and turn, in cost units
+   */
+  FairQueue(const std::vector<u32> &weights, size_t max_depth, size_t quantum)
+      : classes(weights.size()), max_depth{max_depth}, quantum{quantum} {
+    if (weights.empty()) {
+      throw std::invalid_argument("at least one traffic class is required");
+    }
+    for (size_t i = 0; i < weights.size(); i++) {
+      if (weights[i] == 0) {
+        throw std::invalid_argument("class weights must be positive");
+      }
+      classes[i].weight = weights[i];
+    }
+  }
+
+  size_t num_classes() const { return classes.size(); }
+
+  bool empty() const { return pending == 0; }
+
+  /*
+   * @param cls - class index, must be less than num_classes()
+   * @param cost - cost of handling the item, e.g. its size in bytes
+   * @return false if the class queue is full and the item was dropped
+   */
+  bool push(size_t cls, Item item, size_t cost) {
+    Class &c = classes.at(cls);
+    if (c.queue.size() >= max_depth) {
+      c.stats.dropped++;
+      return false;
+    }
+    c.queue.push_back(Entry{std::move(item), cost, clock::now()});
+    c.stats.max_depth = std::max(c.stats.max_depth, c.queue.size());
+    pending++;
+    return true;
+  }
+
+  /*
+   * @return next item to handle or nullopt if all queues are empty
+   */
+  std::optional<Dequeued> pop() {
+    if (pending == 0) {
+      return std::nullopt;
+    }
+    for (;;) {
+      Class &c = classes[current];
+      if (c.queue.empty()) {
+        c.deficit = 0;
+        _next_turn();
+        continue;
+      }
+      if (!turn_granted) {
+        c.deficit += quantum * c.weight;
+        turn_granted = true;
+      }
+      Entry &head = c.queue.front();
+      if (head.cost > c.deficit) {
+        // keep the credit, the item goes out in one of the next turns
+        _next_turn();
+        continue;
+      }
+      c.deficit -= head.cost;
+      Dequeued out{std::move(head.item), current, head.enqueued};
+      c.queue.pop_front();
+      pending--;
+      return out;
+    }
+  }
+
+  /*
+   * Account an item popped earlier as handled.
+   */
+  void done(const Dequeued &dequeued) {
+    ClassStats &stats = classes[dequeued.cls].stats;
+    stats.handled++;
+    stats.latency.record(clock::now() - dequeued.enqueued);
+  }
+
+  /*
+   * Log per-class queue depth, drops and latency since the last report.
+   */
+  void report() {
+    for (size_t i = 0; i < classes.size(); i++) {
+      Class &c = classes[i];
+      spdlog::info("class {} (weight {}): handled={} dropped={} depth={} "
+                   "max_depth={}",
+                   i, c.weight, c.stats.handled, c.stats.dropped,
+                   c.queue.size(), c.stats.max_depth);
+      if (c.stats.handled > 0) {
+        c.stats.latency.report(fmt::format("class {} latency", i));
+      }
+      c.stats = ClassStats{};
+    }
+  }
+};
+
+} // namespace GenlApp
@@ -0,0 +1,106 @@
+#include <cstdlib>
+#include <cstring>
+#include <libnl++/capture.hpp>
+#include <linux/netlink.h>
+#include <string>
+#include <test.hpp>
+#include <unistd.h>
+#include <vector>
+
+using namespace nl;
+
+/*
+ * Capture file removed at the end of the test.
+ */
+struct TempCapture {
+  std::string path;
+
+  TempCapture() {
+    char tmpl[] = "/tmp/nl++-capture-XXXXXX";
+    int fd = mkstemp(tmpl);
+    REQUIRE(fd >= 0);
+    close(fd);
+    path = tmpl;
+  }
+  ~TempCapture() { unlink(path.c_str()); }
+};
+
+TEST(capture_round_trip) {
+  TempCapture file;
+  std::vector<u8> small(40, 0x5a);
+  // bigger than the snap length, the record keeps only the head
+  std::vector<u8> big(300 * 1024);
+  for (size_t i = 0; i < big.size(); i++) {
+    big[i] = static_cast<u8>(i);
+  }
+  {
+    CaptureWriter writer{file.path};
+    writer.write(CaptureDirection::TX, NETLINK_USERSOCK, small.data(),
+                 small.size());
+    writer.write(CaptureDirection::RX, NETLINK_GENERIC, big.data(),
+                 big.size());
+  }
+
+  CaptureReader reader{file.path};
+  for (int pass = 0; pass < 2; pass++) {
+    auto first = reader.next();
+    REQUIRE(first.has_value());
+    CHECK(first->dir == CaptureDirection::TX);
+    CHECK(first->nl_protocol == NETLINK_USERSOCK);
+    CHECK(first->len == small.size() && first->orig_len == small.size());
+    CHECK(memcmp(first->data, small.data(), small.size()) == 0);
+    CHECK(first->timestamp.count() > 0);
+
+    auto second = reader.next();
+    REQUIRE(second.has_value());
+    CHECK(second->dir == CaptureDirection::RX);
+    CHECK(second->nl_protocol == NETLINK_GENERIC);
+    CHECK(second->len < second->orig_len);
+    CHECK(second->orig_len == big.size());
+    CHECK(memcmp(second->data, big.data(), second->len) == 0);
+
+    CHECK(!reader.next().has_value());
+    reader.rewind();
+  }
+}
+
+TEST(capture_reader_stops_at_zeroed_tail) {
+  TempCapture file;
+  u8 datagram[16] = {1, 2, 3};
+  size_t size;
+  {
+    CaptureWriter writer{file.path};
+    writer.write(CaptureDirection::TX, NETLINK_USERSOCK, datagram,
+                 sizeof(datagram));
+    size = writer.size();
+  }
+  // what a writer that crashed leaves behind: the unused preallocated chunk
+  REQUIRE(truncate(file.path.c_str(), static_cast<off_t>(size + 4096)) == 0);
+  CaptureReader reader{file.path};
+  CHECK(reader.next().has_value());
+  CHECK(!reader.next().has_value());
+}
+
+TEST(capture_reader_stops_at_cut_off_record) {
+  TempCapture file;
+  u8 datagram[64] = {};
+  size_t size;
+  {
+    CaptureWriter writer{file.path};
+    writer.write(CaptureDirection::TX, NETLINK_USERSOCK, datagram,
+                 sizeof(datagram));
+    writer.write(CaptureDirection::TX, NETLINK_USERSOCK, datagram,
+                 sizeof(datagram));
+    size = writer.size();
+  }
+  // the file ends in the middle of the second record
+  REQUIRE(truncate(file.path.c_str(), static_cast<off_t>(size - 10)) == 0);
+  CaptureReader reader{file.path};
+  CHECK(reader.next().has_value());
+  CHECK(!reader.next().has_value());
+}
+
+TEST(capture_reader_rejects_other_files) {
+  TempCapture file;
+  CHECK_THROWS(std::runtime_error, CaptureReader{file.path});
+}
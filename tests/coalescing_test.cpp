@@ -0,0 +1,108 @@
+#include <helpers.hpp>
+#include <libnl++/reactor.hpp>
+#include <sys/timerfd.h>
+#include <test.hpp>
+
+using namespace nl;
+using namespace nl::test;
+
+constexpr u32 SERVER_PORT = 1000;
+
+static bool flush_timer_armed(const Socket &sock) {
+  struct itimerspec spec = {};
+  REQUIRE(timerfd_gettime(sock.flush_timer_fd(), &spec) == 0);
+  return spec.it_value.tv_sec != 0 || spec.it_value.tv_nsec != 0;
+}
+
+TEST(reactor_flushes_coalesced_messages_on_deadline) {
+  auto hub = std::make_shared<LoopbackHub>();
+  auto server = make_loopback_socket(hub, SERVER_PORT);
+  auto client = make_loopback_socket(hub);
+  client->set_peer_port(SERVER_PORT);
+  client->enable_coalescing(64 * 1024, std::chrono::milliseconds(10));
+  Received ignored;
+  Reactor reactor;
+  reactor.add_socket(*client, {collect_values, &ignored});
+
+  Message msg = make_value_msg(SERVER_PORT, 7);
+  client->send_msg(msg);
+  CHECK(client->pending_msgs() == 1);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (client->pending_msgs() > 0 &&
+         std::chrono::steady_clock::now() < deadline) {
+    reactor.run_once(100);
+  }
+  CHECK(client->pending_msgs() == 0);
+
+  Received received;
+  server->set_nonblocking(true);
+  server->set_recv_handler({collect_values, &received});
+  receive_values(*server, received, 1);
+  CHECK((received.values == std::vector<u32>{7}));
+}
+
+TEST(socket_flushes_coalesced_messages_before_receiving) {
+  auto hub = std::make_shared<LoopbackHub>();
+  auto server = make_loopback_socket(hub, SERVER_PORT);
+  auto client = make_loopback_socket(hub);
+  client->set_peer_port(SERVER_PORT);
+  client->enable_coalescing(64 * 1024, std::chrono::seconds(10));
+  Message msg = make_value_msg(SERVER_PORT, 1);
+  client->send_msg(msg);
+  client->set_nonblocking(true);
+  client->recv_pending(1);
+  CHECK(client->pending_msgs() == 0);
+
+  Received received;
+  server->set_nonblocking(true);
+  server->set_recv_handler({collect_values, &received});
+  receive_values(*server, received, 1);
+  CHECK(received.values.size() == 1);
+}
+
+TEST(flush_timer_is_armed_only_while_watched) {
+  auto hub = std::make_shared<LoopbackHub>();
+  auto server = make_loopback_socket(hub, SERVER_PORT);
+  auto client = make_loopback_socket(hub);
+  client->set_peer_port(SERVER_PORT);
+  client->enable_coalescing(64 * 1024, std::chrono::seconds(10));
+  Message first = make_value_msg(SERVER_PORT, 1);
+  client->send_msg(first);
+  CHECK(!flush_timer_armed(*client));
+
+  Received ignored;
+  {
+    Reactor reactor;
+    reactor.add_socket(*client, {collect_values, &ignored});
+    // the message queued before is due now that someone watches
+    CHECK(flush_timer_armed(*client));
+    client->flush();
+    CHECK(!flush_timer_armed(*client));
+    Message second = make_value_msg(SERVER_PORT, 2);
+    client->send_msg(second);
+    CHECK(flush_timer_armed(*client));
+  }
+  CHECK(!flush_timer_armed(*client));
+  client->flush();
+}
+
+TEST(flush_timer_is_disarmed_by_size_triggered_flush) {
+  auto hub = std::make_shared<LoopbackHub>();
+  auto server = make_loopback_socket(hub, SERVER_PORT);
+  auto client = make_loopback_socket(hub);
+  client->set_peer_port(SERVER_PORT);
+  Message msg = make_value_msg(SERVER_PORT, 1);
+  // two messages fill a datagram
+  client->enable_coalescing(2 * NLMSG_ALIGN(nlmsg_hdr(msg.get())->nlmsg_len),
+                            std::chrono::seconds(10));
+  Received ignored;
+  Reactor reactor;
+  reactor.add_socket(*client, {collect_values, &ignored});
+  client->send_msg(msg);
+  CHECK(flush_timer_armed(*client));
+  Message next = make_value_msg(SERVER_PORT, 2);
+  client->send_msg(next);
+  CHECK(client->pending_msgs() == 0);
+  CHECK(!flush_timer_armed(*client));
+  CHECK(reactor.run_once(0) == 0);
+}
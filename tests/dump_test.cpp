@@ -0,0 +1,75 @@
+#include <helpers.hpp>
+#include <libnl++/dump.hpp>
+#include <test.hpp>
+
+using namespace nl;
+using namespace nl::test;
+
+constexpr u32 SERVER_PORT = 1000;
+constexpr u32 CLIENT_PORT = 1001;
+constexpr int ATTR_CURSOR = 2;
+
+struct DumpReceived {
+  u64 records = 0;
+  u64 messages = 0;
+  u64 cursor = 0;
+};
+
+callback_result_t count_dump(struct nl_msg *msg, void *ctx) {
+  auto &received = *static_cast<DumpReceived *>(ctx);
+  struct genlmsghdr *genl_header =
+      (genlmsghdr *)nlmsg_data(nlmsg_hdr(msg));
+  struct nlattr *attr;
+  int rem;
+  nla_for_each_attr(attr, genlmsg_attrdata(genl_header, 0),
+                    genlmsg_attrlen(genl_header, 0), rem) {
+    if (nla_type(attr) == ATTR_VALUE) {
+      received.records++;
+    } else if (nla_type(attr) == ATTR_CURSOR) {
+      received.cursor = nla_get_u64(attr);
+    }
+  }
+  received.messages++;
+  return NL_OK;
+}
+
+TEST(dump_parks_on_full_client_queue) {
+  auto hub = std::make_shared<LoopbackHub>();
+  auto server = make_loopback_socket(hub, SERVER_PORT);
+  // room for two messages only
+  auto client = make_loopback_socket(hub, CLIENT_PORT, 2);
+  server->set_peer_port(CLIENT_PORT);
+  server->set_nonblocking(true);
+  DumpReceived received;
+  client->set_nonblocking(true);
+  client->set_recv_handler({count_dump, &received});
+
+  constexpr u64 RECORDS = 100;
+  DumpWriter writer{*server, TEST_CMD, NETLINK_GENERIC, 1, ATTR_CURSOR, 64};
+  u64 next = 0;
+  int parked = 0;
+  while (!writer.is_finished()) {
+    bool sent;
+    if (next < RECORDS) {
+      writer.record().put_attr<u32>(ATTR_VALUE, static_cast<u32>(next));
+      next++;
+      sent = writer.end_record(next);
+    } else {
+      sent = writer.finish();
+    }
+    while (!sent) {
+      parked++;
+      // a parked writer takes no more records
+      CHECK_THROWS(std::logic_error, writer.record());
+      client->recv_pending(64);
+      sent = writer.flush();
+    }
+  }
+  // the rest, including NLMSG_DONE
+  client->recv_pending(64);
+  CHECK(parked > 0);
+  CHECK(received.records == RECORDS);
+  CHECK(received.cursor == RECORDS);
+  CHECK(received.messages == writer.messages());
+  CHECK(client->recv_ctx.nl_recv_status == RecvStatus::FINISH);
+}
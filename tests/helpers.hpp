@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <libnl++/loopback.hpp>
+#include <libnl++/message.hpp>
+#include <libnl++/socket.hpp>
+#include <memory>
+#include <netlink/genl/genl.h>
+#include <vector>
+
+namespace nl::test {
+
+constexpr u8 TEST_CMD = 1;
+constexpr int ATTR_VALUE = 1; // u32
+
+inline std::unique_ptr<Socket>
+make_loopback_socket(const std::shared_ptr<LoopbackHub> &hub, u32 port = 0,
+                     size_t queue_slots = 1024) {
+  return std::make_unique<Socket>(
+      std::make_unique<LoopbackTransport>(hub, queue_slots), NETLINK_USERSOCK,
+      port);
+}
+
+inline Message make_value_msg(u32 port, u32 value) {
+  Message msg;
+  msg.put_header(TEST_CMD, NETLINK_GENERIC, port).put_attr<u32>(ATTR_VALUE,
+                                                                value);
+  return msg;
+}
+
+/*
+ * Received messages in arrival order, filled by collect_values().
+ */
+struct Received {
+  std::vector<u32> values;
+  std::vector<u32> ports; // sender of each value
+};
+
+inline callback_result_t collect_values(struct nl_msg *msg, void *ctx) {
+  auto &received = *static_cast<Received *>(ctx);
+  struct genlmsghdr *genl_header =
+      (genlmsghdr *)nlmsg_data(nlmsg_hdr(msg));
+  struct nlattr *attr = nla_find(genlmsg_attrdata(genl_header, 0),
+                                 genlmsg_attrlen(genl_header, 0), ATTR_VALUE);
+  if (attr != nullptr && nla_len(attr) == sizeof(u32)) {
+    received.values.push_back(nla_get_u32(attr));
+    received.ports.push_back(nlmsg_get_src(msg)->nl_pid);
+  }
+  return NL_OK;
+}
+
+/*
+ * Drain a non-blocking socket until it delivered count values or the timeout
+ * expired.
+ */
+inline void receive_values(Socket &sock, Received &received, size_t count,
+                           std::chrono::milliseconds timeout =
+                               std::chrono::seconds(5)) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (received.values.size() < count &&
+         std::chrono::steady_clock::now() < deadline) {
+    sock.recv_pending(64);
+  }
+}
+
+} // namespace nl::test
@@ -0,0 +1,69 @@
+#include <cctype>
+#include <iomanip>
+#include <libnl++/util.hpp>
+#include <sstream>
+#include <string>
+#include <test.hpp>
+#include <vector>
+
+/*
+ * The iostream-based hexdump format_hexdump() replaced, kept as the
+ * reference for its output.
+ */
+std::string reference_hexdump(const void *data, size_t length,
+                              size_t bytes_per_line) {
+  const uint8_t *ptr = static_cast<const uint8_t *>(data);
+  std::ostringstream out;
+  for (size_t i = 0; i < length; i += bytes_per_line) {
+    out << std::setw(8) << std::setfill('0') << std::hex << i << "  ";
+    for (size_t j = 0; j < bytes_per_line; ++j) {
+      if (i + j < length) {
+        out << std::setw(2) << static_cast<int>(ptr[i + j]) << " ";
+      } else {
+        out << "   ";
+      }
+      if (j == 7) {
+        out << " ";
+      }
+    }
+    out << " ";
+    for (size_t j = 0; j < bytes_per_line; ++j) {
+      if (i + j < length) {
+        char cur_char = static_cast<char>(ptr[i + j]);
+        out << (std::isprint(static_cast<unsigned char>(cur_char)) != 0
+                    ? cur_char
+                    : '.');
+      } else {
+        out << ' ';
+      }
+    }
+    out << "\n";
+  }
+  return out.str();
+}
+
+TEST(format_hexdump_matches_reference) {
+  std::vector<uint8_t> data(300);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<uint8_t>(i * 7 + 3);
+  }
+  for (size_t bytes_per_line : {16, 8, 20}) {
+    for (size_t length : {0, 1, 7, 8, 15, 16, 17, 32, 33, 255, 300}) {
+      std::string expected =
+          reference_hexdump(data.data(), length, bytes_per_line);
+      std::string out(nl::hexdump_size(length, bytes_per_line), '\0');
+      size_t n = nl::format_hexdump(out.data(), out.size(), data.data(),
+                                    length, bytes_per_line);
+      CHECK(n == out.size());
+      CHECK(out == expected);
+    }
+  }
+}
+
+TEST(format_hexdump_writes_only_complete_lines) {
+  uint8_t data[40] = {};
+  char out[100];
+  // room for one 16 byte line (78 characters) but not two
+  size_t n = nl::format_hexdump(out, sizeof(out), data, sizeof(data));
+  CHECK(n == nl::hexdump_size(16));
+}
@@ -0,0 +1,16 @@
+#include <chrono>
+#include <latency.hpp>
+#include <test.hpp>
+
+TEST(latency_percentiles_use_nearest_rank) {
+  GenlApp::LatencyHistogram histogram;
+  for (int i = 1; i <= 10; i++) {
+    histogram.record(std::chrono::nanoseconds(i));
+  }
+  CHECK(histogram.count() == 10);
+  CHECK(histogram.percentile(0) == 1);
+  CHECK(histogram.percentile(50) == 5);
+  CHECK(histogram.percentile(90) == 9);
+  CHECK(histogram.percentile(95) == 10);
+  CHECK(histogram.percentile(100) == 10);
+}
@@ -0,0 +1,126 @@
+#include <helpers.hpp>
+#include <libnl++/reactor.hpp>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <test.hpp>
+#include <thread>
+#include <unistd.h>
+
+using namespace nl;
+using namespace nl::test;
+
+constexpr u32 SERVER_PORT = 1000;
+
+bool fd_readable(int fd) {
+  struct pollfd pfd = {.fd = fd, .events = POLLIN, .revents = 0};
+  return poll(&pfd, 1, 0) == 1;
+}
+
+TEST(reactor_wakes_up_on_loopback_eventfd) {
+  auto hub = std::make_shared<LoopbackHub>();
+  auto server = make_loopback_socket(hub, SERVER_PORT);
+  Received received;
+  Reactor reactor;
+  reactor.add_socket(*server, {collect_values, &received});
+  CHECK(!fd_readable(server->fd()));
+
+  std::thread sender{[&hub] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    auto client = make_loopback_socket(hub);
+    client->set_peer_port(SERVER_PORT);
+    for (u32 i = 0; i < 3; i++) {
+      Message msg = make_value_msg(SERVER_PORT, i);
+      client->send_msg(msg);
+    }
+  }};
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+  while (received.values.size() < 3 &&
+         std::chrono::steady_clock::now() < deadline) {
+    reactor.run_once(1000);
+  }
+  sender.join();
+  CHECK((received.values == std::vector<u32>{0, 1, 2}));
+  // the queue was drained, so the eventfd must not wake the reactor again
+  CHECK(!fd_readable(server->fd()));
+  CHECK(reactor.run_once(0) == 0);
+}
+
+TEST(reactor_stop_from_another_thread) {
+  Reactor reactor;
+  std::thread stopper{[&reactor] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    reactor.stop();
+  }};
+  reactor.run();
+  stopper.join();
+}
+
+TEST(reactor_stop_before_run_is_not_lost) {
+  Reactor reactor;
+  reactor.stop();
+  // returns right away instead of waiting for events
+  reactor.run();
+  // and the next run() waits for another stop()
+  std::thread stopper{[&reactor] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    reactor.stop();
+  }};
+  auto start = std::chrono::steady_clock::now();
+  reactor.run();
+  stopper.join();
+  CHECK(std::chrono::steady_clock::now() - start >=
+        std::chrono::milliseconds(10));
+}
+
+TEST(reactor_timer_readded_from_its_own_handler) {
+  Reactor reactor;
+  int fired = 0;
+  int timer_id = -1;
+  Reactor::timer_handler_t handler = [&] {
+    fired++;
+    // the new timerfd usually gets the number of the cancelled one
+    reactor.cancel_timer(timer_id);
+    if (fired < 3) {
+      timer_id = reactor.add_timer(std::chrono::milliseconds(1), handler);
+    }
+  };
+  timer_id = reactor.add_timer(std::chrono::milliseconds(1), handler);
+  int events = 0;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  while (fired < 3 && std::chrono::steady_clock::now() < deadline) {
+    events += reactor.run_once(100);
+  }
+  CHECK(fired == 3);
+  CHECK(events == 3);
+  // nothing is left behind in epoll without an entry
+  CHECK(reactor.run_once(0) == 0);
+}
+
+TEST(reactor_fd_replaced_within_a_batch) {
+  Reactor reactor;
+  int first = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  REQUIRE(first >= 0);
+  int second = -1;
+  int second_calls = 0;
+  auto second_handler = [&](u32) {
+    u64 count;
+    (void)!read(second, &count, sizeof(count));
+    second_calls++;
+  };
+  reactor.add_fd(first, EPOLLIN, [&](u32) {
+    reactor.remove_fd(first);
+    close(first);
+    second = eventfd(1, EFD_CLOEXEC | EFD_NONBLOCK);
+    reactor.add_fd(second, EPOLLIN, second_handler);
+  });
+  u64 one = 1;
+  REQUIRE(write(first, &one, sizeof(one)) == sizeof(one));
+  CHECK(reactor.run_once(1000) == 1);
+  REQUIRE(second >= 0);
+  CHECK(reactor.run_once(1000) == 1);
+  CHECK(second_calls == 1);
+  CHECK(reactor.run_once(0) == 0);
+  reactor.remove_fd(second);
+  close(second);
+}
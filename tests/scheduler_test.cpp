@@ -0,0 +1,58 @@
+#include <scheduler.hpp>
+#include <stdexcept>
+#include <test.hpp>
+
+using GenlApp::FairQueue;
+
+TEST(fair_queue_shares_by_weight) {
+  FairQueue<int> queue{{3, 1}, 100, 10};
+  for (int i = 0; i < 100; i++) {
+    CHECK(queue.push(0, i, 10));
+    CHECK(queue.push(1, i, 10));
+  }
+  int served[2] = {0, 0};
+  for (int i = 0; i < 40; i++) {
+    auto item = queue.pop();
+    REQUIRE(item.has_value());
+    served[item->cls]++;
+    queue.done(*item);
+  }
+  CHECK(served[0] == 30);
+  CHECK(served[1] == 10);
+}
+
+TEST(fair_queue_keeps_order_within_class) {
+  FairQueue<int> queue{{1, 1}, 100, 10};
+  for (int i = 0; i < 10; i++) {
+    queue.push(i % 2, i, 10);
+  }
+  int last[2] = {-1, -1};
+  while (auto item = queue.pop()) {
+    CHECK(item->item > last[item->cls]);
+    last[item->cls] = item->item;
+  }
+  CHECK(queue.empty());
+}
+
+TEST(fair_queue_drops_only_the_full_class) {
+  FairQueue<int> queue{{1, 1}, 2, 10};
+  CHECK(queue.push(0, 1, 10));
+  CHECK(queue.push(0, 2, 10));
+  CHECK(!queue.push(0, 3, 10));
+  CHECK(queue.push(1, 4, 10));
+}
+
+TEST(fair_queue_large_items_wait_for_credit) {
+  // an item costing more than one turn's credit still goes out eventually
+  FairQueue<int> queue{{1}, 10, 10};
+  queue.push(0, 1, 35);
+  auto item = queue.pop();
+  REQUIRE(item.has_value());
+  CHECK(item->item == 1);
+  CHECK(!queue.pop().has_value());
+}
+
+TEST(fair_queue_rejects_bad_weights) {
+  CHECK_THROWS(std::invalid_argument, FairQueue<int>({}, 10, 10));
+  CHECK_THROWS(std::invalid_argument, FairQueue<int>({1, 0}, 10, 10));
+}
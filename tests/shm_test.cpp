@@ -0,0 +1,113 @@
+#include <cstring>
+#include <libnl++/shm.hpp>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <test.hpp>
+#include <unistd.h>
+
+using namespace nl;
+
+TEST(shm_ring_round_trip) {
+  ShmRing producer = ShmRing::create(64);
+  ShmRing consumer = ShmRing::attach(getpid(), producer.fd());
+  CHECK(consumer.capacity() == 64);
+  // several laps, so payloads wrap around the end of the data area
+  for (u32 i = 0; i < 20; i++) {
+    char payload[24];
+    memset(payload, 'a' + static_cast<int>(i), sizeof(payload));
+    auto desc = producer.write(payload, sizeof(payload));
+    REQUIRE(desc.has_value());
+    CHECK(memcmp(consumer.read(*desc), payload, sizeof(payload)) == 0);
+    consumer.release(*desc);
+  }
+}
+
+TEST(shm_ring_full_until_released) {
+  ShmRing producer = ShmRing::create(64);
+  ShmRing consumer = ShmRing::attach(getpid(), producer.fd());
+  char payload[32] = {};
+  auto first = producer.write(payload, sizeof(payload));
+  auto second = producer.write(payload, sizeof(payload));
+  REQUIRE(first && second);
+  CHECK(!producer.write(payload, 1));
+  CHECK(!producer.write(payload, 65));
+  consumer.release(*first);
+  CHECK(producer.write(payload, sizeof(payload)).has_value());
+}
+
+TEST(shm_ring_rejects_tampered_header) {
+  ShmRing producer = ShmRing::create(4096);
+  ShmRing consumer = ShmRing::attach(getpid(), producer.fd());
+  auto *raw = static_cast<u64 *>(mmap(nullptr, 4096, PROT_READ | PROT_WRITE,
+                                      MAP_SHARED, producer.fd(), 0));
+  REQUIRE(raw != MAP_FAILED);
+  // the peer raises the capacity and forges a descriptor past the mapping
+  raw[1] = 1ULL << 40;
+  CHECK(consumer.capacity() == 4096);
+  ShmDescriptor forged{.position = 4090, .length = 16, .reserved = 0};
+  CHECK_THROWS(std::invalid_argument, consumer.read(forged));
+  // the peer moves head far beyond what the ring can hold
+  raw[8] = 1ULL << 50;
+  ShmDescriptor desc{.position = 0, .length = 16, .reserved = 0};
+  CHECK_THROWS(std::invalid_argument, consumer.read(desc));
+  munmap(raw, 4096);
+}
+
+TEST(shm_attach_rejects_other_files) {
+  int fd = eventfd(0, EFD_CLOEXEC);
+  REQUIRE(fd >= 0);
+  CHECK_THROWS(std::runtime_error, ShmRing::attach(getpid(), fd));
+  close(fd);
+}
+
+TEST(shm_ring_rejects_descriptor_of_an_earlier_lap) {
+  ShmRing producer = ShmRing::create(64);
+  ShmRing consumer = ShmRing::attach(getpid(), producer.fd());
+  char payload[32] = {};
+  auto old = producer.write(payload, sizeof(payload));
+  REQUIRE(old.has_value());
+  consumer.release(*old);
+  auto next = producer.write(payload, sizeof(payload));
+  REQUIRE(next.has_value());
+  consumer.release(*next);
+  // a whole lap later the same offset holds another payload
+  auto current = producer.write(payload, sizeof(payload));
+  REQUIRE(current.has_value());
+  CHECK(current->position % 64 == old->position % 64);
+  CHECK_THROWS(std::invalid_argument, consumer.read(*old));
+  CHECK(consumer.read(*current) != nullptr);
+}
+
+TEST(shm_ring_notices_exited_owner) {
+  int to_parent[2];
+  int to_child[2];
+  REQUIRE(pipe(to_parent) == 0 && pipe(to_child) == 0);
+  pid_t child = fork();
+  REQUIRE(child >= 0);
+  if (child == 0) {
+    // the producer exits without any teardown once the parent attached
+    ShmRing producer = ShmRing::create(64);
+    int fd = producer.fd();
+    char done;
+    if (write(to_parent[1], &fd, sizeof(fd)) != sizeof(fd) ||
+        read(to_child[0], &done, 1) != 1) {
+      _exit(1);
+    }
+    _exit(0);
+  }
+  int fd = -1;
+  REQUIRE(read(to_parent[0], &fd, sizeof(fd)) == sizeof(fd));
+  ShmRing consumer = ShmRing::attach(child, fd);
+  CHECK(consumer.owner_alive());
+  REQUIRE(write(to_child[1], "x", 1) == 1);
+  int status;
+  REQUIRE(waitpid(child, &status, 0) == child);
+  CHECK(!consumer.owner_alive());
+  for (int pipe_fd : {to_parent[0], to_parent[1], to_child[0], to_child[1]}) {
+    close(pipe_fd);
+  }
+  // the producer side has no owner to lose
+  CHECK(ShmRing::create(64).owner_alive());
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdio>
+#include <exception>
+#include <vector>
+
+/*
+ * Minimal test harness, so the tests don't need a framework the tree doesn't
+ * vendor. TEST() registers a test case, CHECK() records a failure and goes
+ * on, REQUIRE() records a failure and ends the test case.
+ */
+namespace nl::test {
+
+struct TestCase {
+  const char *name;
+  void (*fn)();
+};
+
+inline std::vector<TestCase> &registry() {
+  static std::vector<TestCase> cases;
+  return cases;
+}
+
+struct Registrar {
+  Registrar(const char *name, void (*fn)()) {
+    registry().push_back({name, fn});
+  }
+};
+
+// thrown by REQUIRE() to end the current test case
+struct RequireFailed : std::exception {};
+
+inline int failed_checks = 0;
+
+inline void report_failure(const char *file, int line, const char *expr) {
+  std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+  failed_checks++;
+}
+
+} // namespace nl::test
+
+#define TEST(name)                                                             \
+  static void test_##name();                                                   \
+  static nl::test::Registrar registrar_##name{#name, test_##name};             \
+  static void test_##name()
+
+#define CHECK(expr)                                                            \
+  do {                                                                         \
+    if (!(expr)) {                                                             \
+      nl::test::report_failure(__FILE__, __LINE__, #expr);                     \
+    }                                                                          \
+  } while (0)
+
+#define REQUIRE(expr)                                                          \
+  do {                                                                         \
+    if (!(expr)) {                                                             \
+      nl::test::report_failure(__FILE__, __LINE__, #expr);                     \
+      throw nl::test::RequireFailed{};                                         \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_THROWS(exc_type, expr)                                           \
+  do {                                                                         \
+    bool thrown = false;                                                       \
+    try {                                                                      \
+      (void)(expr);                                                            \
+    } catch (exc_type &) {                                                     \
+      thrown = true;                                                           \
+    }                                                                          \
+    if (!thrown) {                                                             \
+      nl::test::report_failure(__FILE__, __LINE__,                             \
+                               #expr " throws " #exc_type);                    \
+    }                                                                          \
+  } while (0)
@@ -0,0 +1,34 @@
+#include <cstring>
+#include <spdlog/spdlog.h>
+#include <test.hpp>
+
+/*
+ * Run all test cases, or those whose name contains the first argument.
+ */
+int main(int argc, char **argv) {
+  spdlog::set_level(spdlog::level::warn);
+  const char *filter = argc > 1 ? argv[1] : nullptr;
+  int failed_cases = 0;
+  int run = 0;
+  for (const auto &test_case : nl::test::registry()) {
+    if (filter != nullptr && strstr(test_case.name, filter) == nullptr) {
+      continue;
+    }
+    int failed_before = nl::test::failed_checks;
+    try {
+      test_case.fn();
+    } catch (nl::test::RequireFailed &) {
+      // already reported
+    } catch (std::exception &e) {
+      std::fprintf(stderr, "%s: unexpected exception: %s\n", test_case.name,
+                   e.what());
+      nl::test::failed_checks++;
+    }
+    bool ok = nl::test::failed_checks == failed_before;
+    std::printf("[%s] %s\n", ok ? " OK " : "FAIL", test_case.name);
+    failed_cases += ok ? 0 : 1;
+    run++;
+  }
+  std::printf("%d of %d test cases passed\n", run - failed_cases, run);
+  return failed_cases == 0 ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+#include <libnl++/trace.hpp>
+#include <libnl++/util.hpp>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <test.hpp>
+#include <thread>
+#include <unistd.h>
+
+using namespace nl;
+
+/*
+ * Run trace::dump() into a memfd and return what it wrote.
+ */
+static std::string dump_to_string() {
+  int fd = memfd_create("nl++-trace-test", MFD_CLOEXEC);
+  REQUIRE(fd >= 0);
+  trace::dump(fd);
+  off_t size = lseek(fd, 0, SEEK_CUR);
+  std::string out(static_cast<size_t>(size), '\0');
+  REQUIRE(pread(fd, out.data(), out.size(), 0) == size);
+  close(fd);
+  return out;
+}
+
+static std::string ring_header(pid_t tid, bool exited) {
+  return "--- netlink trace of thread " + std::to_string(tid) +
+         (exited ? " (exited)" : "") + ",";
+}
+
+/*
+ * Record one datagram from a new thread, which exits right after.
+ * @return tid of the thread
+ */
+static pid_t record_from_thread(u32 port) {
+  pid_t tid = 0;
+  std::thread thread{[&tid, port] {
+    tid = static_cast<pid_t>(syscall(SYS_gettid));
+    u8 datagram[4] = {0xde, 0xad, 0xbe, 0xef};
+    trace::record(CaptureDirection::RX, port, datagram, sizeof(datagram));
+  }};
+  thread.join();
+  return tid;
+}
+
+TEST(trace_records_only_while_enabled) {
+  u8 datagram[300];
+  for (size_t i = 0; i < sizeof(datagram); i++) {
+    datagram[i] = static_cast<u8>(i);
+  }
+  trace::record(CaptureDirection::TX, 4001, datagram, sizeof(datagram));
+  trace::enable();
+  trace::record(CaptureDirection::TX, 4002, datagram, sizeof(datagram));
+  trace::enable(false);
+
+  std::string out = dump_to_string();
+  CHECK(out.find(" port 4001 ") == std::string::npos);
+  CHECK(out.find(" tx port 4002 len 300\n") != std::string::npos);
+  // only the first SNAPLEN bytes are kept
+  char hex[2048];
+  size_t n = format_hexdump(hex, sizeof(hex), datagram, trace::SNAPLEN);
+  CHECK(out.find(std::string(hex, n)) != std::string::npos);
+  CHECK(out.find(ring_header(static_cast<pid_t>(syscall(SYS_gettid)),
+                             false)) != std::string::npos);
+}
+
+TEST(trace_keeps_rings_of_exited_threads) {
+  trace::enable();
+  pid_t first = record_from_thread(4101);
+  pid_t second = record_from_thread(4102);
+  trace::enable(false);
+
+  // the second thread got a ring of its own instead of the first one's
+  CHECK(first != second);
+  std::string out = dump_to_string();
+  CHECK(out.find(ring_header(first, true)) != std::string::npos);
+  CHECK(out.find(ring_header(second, true)) != std::string::npos);
+  CHECK(out.find(" rx port 4101 len 4\n") != std::string::npos);
+  CHECK(out.find(" rx port 4102 len 4\n") != std::string::npos);
+}
+
+TEST(trace_reuses_rings_of_exited_threads_once_all_exist) {
+  trace::enable();
+  for (size_t i = 0; i < trace::MAX_RINGS; i++) {
+    record_from_thread(4200);
+  }
+  // no ring is left, this thread takes over one of an exited thread
+  pid_t tid = record_from_thread(4201);
+  trace::enable(false);
+
+  std::string out = dump_to_string();
+  size_t rings = 0;
+  for (size_t pos = out.find("--- netlink trace of thread ");
+       pos != std::string::npos;
+       pos = out.find("--- netlink trace of thread ", pos + 1)) {
+    rings++;
+  }
+  CHECK(rings == trace::MAX_RINGS);
+  CHECK(out.find(ring_header(tid, true)) != std::string::npos);
+  CHECK(out.find(" rx port 4201 len 4\n") != std::string::npos);
+}